@@ -7,6 +7,7 @@
 #include "config_set.h"
 #include "helpers.h"
 #include "run.h"
+#include "runner.h"
 #include "runner_start.h"
 #include "runner_stop.h"
 #include "start.h"
@@ -37,6 +38,9 @@ void ParseRunnerAction(int argc, char **argv) {
         InvokeWithOptions<RunnerStartOptions>(argc - 1, argv + 1, RunnerStart);
     } else if (strcmp(argv[1], "stop") == 0) {
         InvokeWithOptions<RunnerStopOptions>(argc - 1, argv + 1, RunnerStop);
+    } else if (strcmp(argv[1], "task") == 0) {
+        // Internal, spawned by a runner for every request it processes.
+        RunnerTask();
     } else {
         std::cerr << "Unknown action '" << argv[1] << "'." << std::endl;
         std::cerr << "See 'polygraph runner --help'." << std::endl;
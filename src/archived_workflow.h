@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "block_response.h"
+#include "serialize.h"
+
+struct ArchivedWorkflow {
+    std::string workflow_id;
+    std::string partition;
+    size_t cnt_workflow_runs;
+    std::vector<BlockResponse> blocks;
+};
+
+template <>
+inline rapidjson::Value Serialize<ArchivedWorkflow>(const ArchivedWorkflow &data,
+                                                    rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("workflow-id", Serialize(data.workflow_id, alloc), alloc);
+    value.AddMember("partition", Serialize(data.partition, alloc), alloc);
+    value.AddMember("cnt-workflow-runs", Serialize(data.cnt_workflow_runs, alloc), alloc);
+    value.AddMember("blocks", Serialize(data.blocks, alloc), alloc);
+    return value;
+}
+
+template <>
+inline void Deserialize<ArchivedWorkflow>(ArchivedWorkflow &data, const rapidjson::Value &value) {
+    Deserialize(data.workflow_id, value["workflow-id"]);
+    Deserialize(data.partition, value["partition"]);
+    Deserialize(data.cnt_workflow_runs, value["cnt-workflow-runs"]);
+    Deserialize(data.blocks, value["blocks"]);
+}
+
+template <>
+inline void Write<ArchivedWorkflow>(const ArchivedWorkflow &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("workflow-id");
+    Write(data.workflow_id, writer);
+    writer.Key("partition");
+    Write(data.partition, writer);
+    writer.Key("cnt-workflow-runs");
+    Write(data.cnt_workflow_runs, writer);
+    writer.Key("blocks");
+    Write(data.blocks, writer);
+    writer.EndObject();
+}
+
+// Rough footprint of an archived workflow, charged to the memory budget of its shard.
+inline size_t GetMemoryUsage(const ArchivedWorkflow &archived) {
+    size_t memory_usage = sizeof(ArchivedWorkflow) + archived.workflow_id.size() +
+                          archived.partition.size();
+    memory_usage += archived.blocks.size() * sizeof(BlockResponse);
+    for (const auto &block : archived.blocks) {
+        memory_usage += block.state.size();
+        if (block.error.has_value()) {
+            memory_usage += block.error->size();
+        }
+    }
+    return memory_usage;
+}
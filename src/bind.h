@@ -1,8 +1,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
+#include "json_reader.h"
 #include "serialize.h"
+#include "wire.h"
 
 struct Bind {
     std::string inside, outside;
@@ -25,3 +28,46 @@ inline void Deserialize<Bind>(Bind &data, const rapidjson::Value &value) {
     Deserialize(data.outside, value["outside"]);
     Deserialize(data.readonly, value["readonly"]);
 }
+
+template <>
+inline void Write<Bind>(const Bind &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("inside");
+    Write(data.inside, writer);
+    writer.Key("outside");
+    Write(data.outside, writer);
+    writer.Key("readonly");
+    Write(data.readonly, writer);
+    writer.EndObject();
+}
+
+template <>
+inline void Read<Bind>(Bind &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "inside") {
+            Read(data.inside, reader);
+        } else if (key == "outside") {
+            Read(data.outside, reader);
+        } else if (key == "readonly") {
+            Read(data.readonly, reader);
+        } else {
+            reader.Skip();
+        }
+    }
+}
+
+template <>
+inline void Encode<Bind>(const Bind &data, std::string &out) {
+    Encode(data.inside, out);
+    Encode(data.outside, out);
+    Encode(data.readonly, out);
+}
+
+template <>
+inline void Decode<Bind>(Bind &data, WireReader &reader) {
+    Decode(data.inside, reader);
+    Decode(data.outside, reader);
+    Decode(data.readonly, reader);
+}
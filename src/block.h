@@ -16,6 +16,7 @@ struct Block {
     std::vector<Bind> binds;
     std::vector<std::string> argv, env;
     Constraints constraints;
+    bool cache_results = false;
 };
 
 template <>
@@ -28,6 +29,7 @@ inline rapidjson::Value Serialize<Block>(const Block &data, rapidjson::Document:
     value.AddMember("argv", Serialize(data.argv, alloc), alloc);
     value.AddMember("env", Serialize(data.env, alloc), alloc);
     value.AddMember("constraints", Serialize(data.constraints, alloc), alloc);
+    value.AddMember("cache-results", Serialize(data.cache_results, alloc), alloc);
     return value;
 }
 
@@ -40,4 +42,29 @@ inline void Deserialize<Block>(Block &data, const rapidjson::Value &value) {
     Deserialize(data.argv, value["argv"]);
     Deserialize(data.env, value["env"]);
     Deserialize(data.constraints, value["constraints"]);
+    if (value.HasMember("cache-results")) {
+        Deserialize(data.cache_results, value["cache-results"]);
+    }
+}
+
+template <>
+inline void Write<Block>(const Block &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("name");
+    Write(data.name, writer);
+    writer.Key("inputs");
+    Write(data.inputs, writer);
+    writer.Key("outputs");
+    Write(data.outputs, writer);
+    writer.Key("binds");
+    Write(data.binds, writer);
+    writer.Key("argv");
+    Write(data.argv, writer);
+    writer.Key("env");
+    Write(data.env, writer);
+    writer.Key("constraints");
+    Write(data.constraints, writer);
+    writer.Key("cache-results");
+    Write(data.cache_results, writer);
+    writer.EndObject();
 }
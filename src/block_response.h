@@ -3,7 +3,9 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 
+#include "json_reader.h"
 #include "run_status.h"
 #include "serialize.h"
 
@@ -12,6 +14,7 @@ struct BlockResponse {
     std::string state;
     std::optional<std::string> error;
     std::optional<RunStatus> status;
+    std::optional<size_t> retry;
 };
 
 template <>
@@ -26,6 +29,9 @@ inline rapidjson::Value Serialize<BlockResponse>(const BlockResponse &data,
     if (data.status.has_value()) {
         value.AddMember("status", Serialize(data.status, alloc), alloc);
     }
+    if (data.retry.has_value()) {
+        value.AddMember("retry", Serialize(data.retry, alloc), alloc);
+    }
     return value;
 }
 
@@ -39,4 +45,50 @@ inline void Deserialize<BlockResponse>(BlockResponse &data, const rapidjson::Val
     if (value.HasMember("status")) {
         Deserialize(data.status, value["status"]);
     }
+    if (value.HasMember("retry")) {
+        Deserialize(data.retry, value["retry"]);
+    }
+}
+
+template <>
+inline void Write<BlockResponse>(const BlockResponse &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("block-id");
+    Write(data.block_id, writer);
+    writer.Key("state");
+    Write(data.state, writer);
+    if (data.error.has_value()) {
+        writer.Key("error");
+        Write(data.error, writer);
+    }
+    if (data.status.has_value()) {
+        writer.Key("status");
+        Write(data.status, writer);
+    }
+    if (data.retry.has_value()) {
+        writer.Key("retry");
+        Write(data.retry, writer);
+    }
+    writer.EndObject();
+}
+
+template <>
+inline void Read<BlockResponse>(BlockResponse &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "block-id") {
+            Read(data.block_id, reader);
+        } else if (key == "state") {
+            Read(data.state, reader);
+        } else if (key == "error") {
+            Read(data.error, reader);
+        } else if (key == "status") {
+            Read(data.status, reader);
+        } else if (key == "retry") {
+            Read(data.retry, reader);
+        } else {
+            reader.Skip();
+        }
+    }
 }
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "block_response.h"
+#include "output_file.h"
+#include "run_status.h"
+#include "serialize.h"
+
+struct BlockState {
+    size_t cnt_runs = 0;
+    size_t cnt_retries = 0;
+    size_t cnt_inputs_ready = 0;
+    std::vector<std::optional<std::string>> input_sources;
+    std::vector<std::string> input_nodes;
+    std::vector<int64_t> input_sizes;
+    std::optional<int64_t> wall_time_usage_ms;
+    int64_t priority = 0;
+    bool dispatched = false;
+    bool stream_cancelled = false;
+    std::string node;
+    std::string container_path;
+    std::string speculative_container_path, speculative_node;
+    std::optional<std::string> cache_key;
+    std::vector<std::optional<std::string>> input_digests, last_input_digests;
+    std::vector<std::string> output_digests;
+    std::vector<std::optional<OutputFile>> output_files;
+    std::optional<RunStatus> last_status;
+    std::optional<std::string> last_binds_digest;
+    size_t last_workflow_run = 0;
+    size_t cnt_dispatches = 0;
+    std::optional<BlockResponse> last_response;
+};
+
+template <>
+inline rapidjson::Value Serialize<BlockState>(const BlockState &data,
+                                              rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("cnt-runs", Serialize(data.cnt_runs, alloc), alloc);
+    value.AddMember("cnt-retries", Serialize(data.cnt_retries, alloc), alloc);
+    value.AddMember("cnt-inputs-ready", Serialize(data.cnt_inputs_ready, alloc), alloc);
+    value.AddMember("input-sources", Serialize(data.input_sources, alloc), alloc);
+    value.AddMember("input-nodes", Serialize(data.input_nodes, alloc), alloc);
+    value.AddMember("input-sizes", Serialize(data.input_sizes, alloc), alloc);
+    value.AddMember("wall-time-usage-ms", Serialize(data.wall_time_usage_ms, alloc), alloc);
+    value.AddMember("priority", Serialize(data.priority, alloc), alloc);
+    value.AddMember("dispatched", Serialize(data.dispatched, alloc), alloc);
+    value.AddMember("stream-cancelled", Serialize(data.stream_cancelled, alloc), alloc);
+    value.AddMember("node", Serialize(data.node, alloc), alloc);
+    value.AddMember("container-path", Serialize(data.container_path, alloc), alloc);
+    value.AddMember("speculative-container-path", Serialize(data.speculative_container_path, alloc),
+                    alloc);
+    value.AddMember("speculative-node", Serialize(data.speculative_node, alloc), alloc);
+    value.AddMember("cache-key", Serialize(data.cache_key, alloc), alloc);
+    value.AddMember("input-digests", Serialize(data.input_digests, alloc), alloc);
+    value.AddMember("last-input-digests", Serialize(data.last_input_digests, alloc), alloc);
+    value.AddMember("output-digests", Serialize(data.output_digests, alloc), alloc);
+    value.AddMember("output-files", Serialize(data.output_files, alloc), alloc);
+    value.AddMember("last-status", Serialize(data.last_status, alloc), alloc);
+    value.AddMember("last-binds-digest", Serialize(data.last_binds_digest, alloc), alloc);
+    value.AddMember("last-workflow-run", Serialize(data.last_workflow_run, alloc), alloc);
+    value.AddMember("cnt-dispatches", Serialize(data.cnt_dispatches, alloc), alloc);
+    value.AddMember("last-response", Serialize(data.last_response, alloc), alloc);
+    return value;
+}
+
+template <>
+inline void Deserialize<BlockState>(BlockState &data, const rapidjson::Value &value) {
+    Deserialize(data.cnt_runs, value["cnt-runs"]);
+    Deserialize(data.cnt_retries, value["cnt-retries"]);
+    Deserialize(data.cnt_inputs_ready, value["cnt-inputs-ready"]);
+    Deserialize(data.input_sources, value["input-sources"]);
+    Deserialize(data.input_nodes, value["input-nodes"]);
+    Deserialize(data.input_sizes, value["input-sizes"]);
+    Deserialize(data.wall_time_usage_ms, value["wall-time-usage-ms"]);
+    Deserialize(data.priority, value["priority"]);
+    Deserialize(data.dispatched, value["dispatched"]);
+    Deserialize(data.stream_cancelled, value["stream-cancelled"]);
+    Deserialize(data.node, value["node"]);
+    Deserialize(data.container_path, value["container-path"]);
+    Deserialize(data.speculative_container_path, value["speculative-container-path"]);
+    Deserialize(data.speculative_node, value["speculative-node"]);
+    Deserialize(data.cache_key, value["cache-key"]);
+    Deserialize(data.input_digests, value["input-digests"]);
+    Deserialize(data.last_input_digests, value["last-input-digests"]);
+    Deserialize(data.output_digests, value["output-digests"]);
+    Deserialize(data.output_files, value["output-files"]);
+    Deserialize(data.last_status, value["last-status"]);
+    Deserialize(data.last_binds_digest, value["last-binds-digest"]);
+    Deserialize(data.last_workflow_run, value["last-workflow-run"]);
+    if (value.HasMember("cnt-dispatches")) {
+        Deserialize(data.cnt_dispatches, value["cnt-dispatches"]);
+    }
+    Deserialize(data.last_response, value["last-response"]);
+}
+
+template <>
+inline void Write<BlockState>(const BlockState &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("cnt-runs");
+    Write(data.cnt_runs, writer);
+    writer.Key("cnt-retries");
+    Write(data.cnt_retries, writer);
+    writer.Key("cnt-inputs-ready");
+    Write(data.cnt_inputs_ready, writer);
+    writer.Key("input-sources");
+    Write(data.input_sources, writer);
+    writer.Key("input-nodes");
+    Write(data.input_nodes, writer);
+    writer.Key("input-sizes");
+    Write(data.input_sizes, writer);
+    writer.Key("wall-time-usage-ms");
+    Write(data.wall_time_usage_ms, writer);
+    writer.Key("priority");
+    Write(data.priority, writer);
+    writer.Key("dispatched");
+    Write(data.dispatched, writer);
+    writer.Key("stream-cancelled");
+    Write(data.stream_cancelled, writer);
+    writer.Key("node");
+    Write(data.node, writer);
+    writer.Key("container-path");
+    Write(data.container_path, writer);
+    writer.Key("speculative-container-path");
+    Write(data.speculative_container_path, writer);
+    writer.Key("speculative-node");
+    Write(data.speculative_node, writer);
+    writer.Key("cache-key");
+    Write(data.cache_key, writer);
+    writer.Key("input-digests");
+    Write(data.input_digests, writer);
+    writer.Key("last-input-digests");
+    Write(data.last_input_digests, writer);
+    writer.Key("output-digests");
+    Write(data.output_digests, writer);
+    writer.Key("output-files");
+    Write(data.output_files, writer);
+    writer.Key("last-status");
+    Write(data.last_status, writer);
+    writer.Key("last-binds-digest");
+    Write(data.last_binds_digest, writer);
+    writer.Key("last-workflow-run");
+    Write(data.last_workflow_run, writer);
+    writer.Key("cnt-dispatches");
+    Write(data.cnt_dispatches, writer);
+    writer.Key("last-response");
+    Write(data.last_response, writer);
+    writer.EndObject();
+}
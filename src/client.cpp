@@ -1,12 +1,21 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <filesystem>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include "block_response.h"
 #include "client.h"
+#include "client_snapshot.h"
 #include "config.h"
 #include "definitions.h"
 #include "json.h"
@@ -15,6 +24,11 @@
 
 namespace fs = std::filesystem;
 
+constexpr size_t kStatusWidth = 26;
+constexpr size_t kTimeWidth = 10;
+constexpr size_t kMemoryWidth = 12;
+constexpr size_t kCategoryWidth = 12;
+
 Client::Client(const std::string &workflow_file) {
     auto document = ReadJSON(workflow_file);
     std::string body = StringifyJSON(document);
@@ -29,12 +43,47 @@ Client::Client(const std::string &workflow_file) {
         std::cerr << "Message: " << submit_response.data << std::endl;
         exit(EXIT_FAILURE);
     }
-    std::string workflow_id = submit_response.data;
+    workflow_id_ = submit_response.data;
     Deserialize(workflow_, document);
     blocks_.resize(workflow_.blocks.size());
     cnt_runs_.resize(workflow_.blocks.size());
-    session_.Connect(Config::Get().host, Config::Get().port, "/workflow/" + workflow_id);
-    session_.OnRead([this](const std::string &message) { OnMessage(message); });
+    for (const auto &block : workflow_.blocks) {
+        name_width_ = std::max(name_width_, block.name.length());
+    }
+    // The rows of a table that does not fit on the screen cannot be reached to be redrawn.
+    summarized_ = static_cast<int>(blocks_.size()) + 1 >= TerminalWindow::GetHeight();
+    is_changed_.resize(blocks_.size());
+    categories_.resize(blocks_.size(), PENDING);
+    cnt_blocks_[PENDING] = blocks_.size();
+    start_times_.resize(blocks_.size());
+    Connect(false);
+}
+
+void Client::Connect(bool resume) {
+    std::string target = "/workflow/" + workflow_id_;
+    if (resume) {
+        target += "?after=" + std::to_string(last_seq_);
+    }
+    session_ = std::make_unique<WebsocketClientSession>();
+    session_->Connect(Config::Get().host, Config::Get().port, target);
+    session_->OnRead([this](const std::string &message) { OnMessage(message); });
+    session_->OnTimer(kFrameIntervalMs, [this] { Render(); });
+}
+
+void Client::Reconnect() {
+    // The scheduler keeps the recent events of the workflow, so the client picks up the stream
+    // where it broke instead of losing the updates sent in the meantime.
+    for (int attempt = 0; attempt < kMaxReconnectAttempts; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(kReconnectDelayMs));
+        try {
+            Connect(true);
+            return;
+        } catch (const beast::system_error &error) {
+        }
+    }
+    Render();
+    std::cerr << "Error: lost connection to the scheduler" << std::endl;
+    exit(EXIT_FAILURE);
 }
 
 void ClientInterruptHandler(int signum) {
@@ -45,35 +94,119 @@ void Client::Run() {
     signal(SIGINT, ClientInterruptHandler);
     PrintWarnings();
     PrintBlocks();
-    session_.Write(RUN_SIGNAL);
-    session_.Run();
+    TerminalWindow::Get().Flush();
+    session_->Write(RUN_SIGNAL);
+    while (true) {
+        try {
+            session_->Run();
+            break;
+        } catch (const beast::system_error &error) {
+            Reconnect();
+        }
+    }
+    Render();
     PrintErrors();
 }
 
 void Client::Stop() {
-    session_.Write(STOP_SIGNAL);
+    session_->Write(STOP_SIGNAL);
+}
+
+void Client::OnBlock(const BlockResponse &block) {
+    size_t block_id = block.block_id;
+    blocks_[block_id] = block;
+    if (block.state == RUNNING_STATE) {
+        ++cnt_runs_[block_id];
+    }
+    BlockCategory category = GetCategory(block);
+    if (categories_[block_id] == RUNNING) {
+        running_blocks_.erase({start_times_[block_id], block_id});
+    }
+    if (category == RUNNING) {
+        start_times_[block_id] = std::chrono::steady_clock::now();
+        running_blocks_.emplace(start_times_[block_id], block_id);
+    }
+    --cnt_blocks_[categories_[block_id]];
+    ++cnt_blocks_[category];
+    categories_[block_id] = category;
+    summary_changed_ = true;
+    if (!is_changed_[block_id]) {
+        is_changed_[block_id] = true;
+        changed_blocks_.push_back(block_id);
+    }
+}
+
+Client::BlockCategory Client::GetCategory(const BlockResponse &block) {
+    if (block.state.empty()) {
+        return PENDING;
+    } else if (block.state == RUNNING_STATE) {
+        return RUNNING;
+    } else if (block.state == RETRYING_STATE) {
+        return RETRYING;
+    } else if (!block.error.has_value() && block.status.has_value() && block.status->exited &&
+               block.status->exit_code == 0) {
+        return SUCCEEDED;
+    }
+    return FAILED;
 }
 
 void Client::OnMessage(const std::string &message) {
+    if (message.starts_with(EVENT_SIGNAL)) {
+        std::string_view event = std::string_view(message).substr(strlen(EVENT_SIGNAL) + 1);
+        size_t separator = std::min(event.find(' '), event.size());
+        size_t seq = 0;
+        std::from_chars(event.data(), event.data() + separator, seq);
+        // Events replayed after a reconnection may overlap the ones already received.
+        if (seq <= last_seq_) {
+            return;
+        }
+        last_seq_ = seq;
+        OnEvent(event.substr(std::min(separator + 1, event.size())));
+    } else if (message.starts_with(SNAPSHOT_SIGNAL)) {
+        ClientSnapshot snapshot;
+        Deserialize(snapshot, ParseJSON(message.substr(strlen(SNAPSHOT_SIGNAL) + 1)));
+        last_seq_ = snapshot.seq;
+        // Run counts are taken from the snapshot rather than counted again, since the events
+        // that started the runs are not replayed.
+        for (size_t block_id = 0; block_id < blocks_.size(); ++block_id) {
+            OnBlock({.block_id = block_id});
+            cnt_runs_[block_id] = 0;
+        }
+        for (size_t i = 0; i < snapshot.blocks.size(); ++i) {
+            OnBlock(snapshot.blocks[i]);
+            if (i < snapshot.cnt_runs.size()) {
+                cnt_runs_[snapshot.blocks[i].block_id] = snapshot.cnt_runs[i];
+            }
+        }
+        if (!snapshot.running) {
+            session_->Stop();
+        }
+    } else {
+        OnEvent(message);
+    }
+}
+
+void Client::OnEvent(std::string_view message) {
     if (message.starts_with(WORKFLOW_SIGNAL)) {
-        std::string workflow_state = message.substr(strlen(WORKFLOW_SIGNAL) + 1);
+        std::string_view workflow_state = message.substr(strlen(WORKFLOW_SIGNAL) + 1);
         if (workflow_state == FINISHED_STATE) {
-            session_.Stop();
+            session_->Stop();
             return;
         }
     } else if (message.starts_with(BLOCK_SIGNAL)) {
-        std::string block_response_text = message.substr(strlen(BLOCK_SIGNAL) + 1);
         BlockResponse block;
-        Deserialize(block, ParseJSON(block_response_text));
-        blocks_[block.block_id] = block;
-        if (block.state == RUNNING_STATE) {
-            ++cnt_runs_[block.block_id];
+        FromJSON(block, message.substr(strlen(BLOCK_SIGNAL) + 1));
+        OnBlock(block);
+    } else if (message.starts_with(BLOCK_BATCH_SIGNAL)) {
+        std::vector<BlockResponse> blocks;
+        FromJSON(blocks, message.substr(strlen(BLOCK_BATCH_SIGNAL) + 1));
+        for (const auto &block : blocks) {
+            OnBlock(block);
         }
-        PrintBlocks();
     } else if (message.starts_with(ERROR_SIGNAL)) {
-        std::string error = message.substr(strlen(ERROR_SIGNAL) + 1);
+        std::string_view error = message.substr(strlen(ERROR_SIGNAL) + 1);
         std::cerr << "Error: " << error << std::endl;
-        session_.Stop();
+        session_->Stop();
         exit(EXIT_FAILURE);
     }
 }
@@ -111,6 +244,8 @@ std::string GetExecutionStatus(const BlockResponse &block, size_t cnt_runs) {
             status += " (" + std::to_string(cnt_runs) + ")";
         }
         return status;
+    } else if (block.state == RETRYING_STATE) {
+        return ColoredText("Retrying (" + std::to_string(block.retry.value_or(0)) + ")", YELLOW);
     } else if (block.error.has_value()) {
         return ColoredText("Error", RED);
     } else if (block.status->exited) {
@@ -151,34 +286,80 @@ std::string GetMemoryUsage(const BlockResponse &block) {
 }
 
 void Client::PrintBlocks() {
-    TerminalWindow::Get().Clear();
-    size_t name_width = 0;
-    for (const auto &block : workflow_.blocks) {
-        name_width = std::max(name_width, block.name.length());
+    if (summarized_) {
+        PrintSummary();
+        return;
     }
-    size_t status_width = 26;
-    size_t time_width = 10;
-    size_t memory_width = 12;
+    TerminalWindow::Get().Clear();
     std::string header;
-    header += AlignCenter("", name_width + 2);
+    header += AlignCenter("", name_width_ + 2);
     header += " ";
-    header += AlignLeft("Status", status_width);
+    header += AlignLeft("Status", kStatusWidth);
     header += "  ";
-    header += AlignLeft("Time (sec)", time_width);
+    header += AlignLeft("Time (sec)", kTimeWidth);
     header += "  ";
-    header += AlignLeft("Memory (MiB)", memory_width);
+    header += AlignLeft("Memory (MiB)", kMemoryWidth);
     TerminalWindow::Get().PrintLine(header);
     for (size_t block_id = 0; block_id < blocks_.size(); ++block_id) {
-        std::string line;
-        line += "[" + AlignCenter(workflow_.blocks[block_id].name, name_width) + "]";
-        line += " ";
-        line += AlignLeft(GetExecutionStatus(blocks_[block_id], cnt_runs_[block_id]), status_width);
-        line += "  ";
-        line += AlignLeft(GetTimeUsage(blocks_[block_id]), time_width);
-        line += "  ";
-        line += AlignLeft(GetMemoryUsage(blocks_[block_id]), memory_width);
-        TerminalWindow::Get().PrintLine(line);
+        TerminalWindow::Get().PrintLine(FormatBlock(block_id));
+    }
+}
+
+std::string Client::FormatBlock(size_t block_id) const {
+    std::string line;
+    line += "[" + AlignCenter(workflow_.blocks[block_id].name, name_width_) + "]";
+    line += " ";
+    line += AlignLeft(GetExecutionStatus(blocks_[block_id], cnt_runs_[block_id]), kStatusWidth);
+    line += "  ";
+    line += AlignLeft(GetTimeUsage(blocks_[block_id]), kTimeWidth);
+    line += "  ";
+    line += AlignLeft(GetMemoryUsage(blocks_[block_id]), kMemoryWidth);
+    return line;
+}
+
+void Client::PrintSummary() {
+    static const std::array<std::string, CNT_CATEGORIES> category_names = {
+        "Pending", "Running", "Retrying", ColoredText("Succeeded", GREEN),
+        ColoredText("Failed", RED)};
+    TerminalWindow::Get().Clear();
+    TerminalWindow::Get().PrintLine(AlignLeft("Blocks", kCategoryWidth) +
+                                    std::to_string(blocks_.size()));
+    for (size_t category = 0; category < CNT_CATEGORIES; ++category) {
+        TerminalWindow::Get().PrintLine(AlignLeft(category_names[category], kCategoryWidth) +
+                                        std::to_string(cnt_blocks_[category]));
+    }
+    if (!running_blocks_.empty()) {
+        TerminalWindow::Get().PrintLine("");
+        TerminalWindow::Get().PrintLine("Slowest running blocks:");
+        auto now = std::chrono::steady_clock::now();
+        auto it = running_blocks_.begin();
+        for (size_t i = 0; i < kCntSlowestBlocks && it != running_blocks_.end(); ++i, ++it) {
+            auto [start_time, block_id] = *it;
+            std::stringstream running_time;
+            running_time << std::setprecision(1) << std::fixed
+                         << std::chrono::duration<double>(now - start_time).count() << " sec";
+            TerminalWindow::Get().PrintLine(
+                "[" + AlignCenter(workflow_.blocks[block_id].name, name_width_) + "] " +
+                running_time.str());
+        }
+    }
+    summary_changed_ = false;
+}
+
+void Client::Render() {
+    if (summarized_) {
+        // Running times change with every frame, so the summary is redrawn while anything runs.
+        if (summary_changed_ || !running_blocks_.empty()) {
+            PrintSummary();
+        }
+    } else {
+        for (size_t block_id : changed_blocks_) {
+            TerminalWindow::Get().UpdateLine(block_id + 1, FormatBlock(block_id));
+            is_changed_[block_id] = false;
+        }
+        changed_blocks_.clear();
     }
+    TerminalWindow::Get().Flush();
 }
 
 void Client::PrintErrors() {
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <memory>
+#include <set>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "block_response.h"
@@ -18,16 +24,48 @@ public:
     }
 
 private:
-    WebsocketClientSession session_;
+    enum BlockCategory { PENDING, RUNNING, RETRYING, SUCCEEDED, FAILED, CNT_CATEGORIES };
+
+    std::unique_ptr<WebsocketClientSession> session_;
+    std::string workflow_id_;
+    // Number of the last workflow event received, from which the stream is resumed after the
+    // connection breaks.
+    size_t last_seq_ = 0;
     Workflow workflow_;
     std::vector<BlockResponse> blocks_;
     std::vector<size_t> cnt_runs_;
 
+    // Rendering state. Events only update it, and the terminal is redrawn once per frame: the
+    // changed rows of the table, or the summary when the table does not fit on the screen.
+    size_t name_width_ = 0;
+    bool summarized_ = false;
+    bool summary_changed_ = false;
+    std::vector<size_t> changed_blocks_;
+    std::vector<bool> is_changed_;
+    std::vector<BlockCategory> categories_;
+    std::array<size_t, CNT_CATEGORIES> cnt_blocks_{};
+    std::vector<std::chrono::steady_clock::time_point> start_times_;
+    std::set<std::pair<std::chrono::steady_clock::time_point, size_t>> running_blocks_;
+
+    static constexpr int kFrameIntervalMs = 100;
+    static constexpr size_t kCntSlowestBlocks = 5;
+    static constexpr int kReconnectDelayMs = 1000;
+    static constexpr int kMaxReconnectAttempts = 30;
+
     Client(const std::string &workflow_file);
 
+    void Connect(bool resume);
+    void Reconnect();
+
     void OnMessage(const std::string &message);
+    void OnEvent(std::string_view message);
+    void OnBlock(const BlockResponse &block);
+    static BlockCategory GetCategory(const BlockResponse &block);
 
     void PrintWarnings();
     void PrintBlocks();
+    void PrintSummary();
+    void Render();
+    std::string FormatBlock(size_t block_id) const;
     void PrintErrors();
 };
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "block_response.h"
+#include "serialize.h"
+
+// Current state of a workflow, sent to a reconnecting client in place of the events it missed
+// when they are no longer kept.
+struct ClientSnapshot {
+    size_t seq;
+    bool running;
+    std::vector<BlockResponse> blocks;
+    // Times each of the blocks has been started in the current workflow run, if known.
+    std::vector<size_t> cnt_runs;
+};
+
+template <>
+inline rapidjson::Value Serialize<ClientSnapshot>(const ClientSnapshot &data,
+                                                  rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("seq", Serialize(data.seq, alloc), alloc);
+    value.AddMember("running", Serialize(data.running, alloc), alloc);
+    value.AddMember("blocks", Serialize(data.blocks, alloc), alloc);
+    value.AddMember("cnt-runs", Serialize(data.cnt_runs, alloc), alloc);
+    return value;
+}
+
+template <>
+inline void Deserialize<ClientSnapshot>(ClientSnapshot &data, const rapidjson::Value &value) {
+    Deserialize(data.seq, value["seq"]);
+    Deserialize(data.running, value["running"]);
+    Deserialize(data.blocks, value["blocks"]);
+    if (value.HasMember("cnt-runs")) {
+        Deserialize(data.cnt_runs, value["cnt-runs"]);
+    }
+}
+
+template <>
+inline void Write<ClientSnapshot>(const ClientSnapshot &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("seq");
+    Write(data.seq, writer);
+    writer.Key("running");
+    Write(data.running, writer);
+    writer.Key("blocks");
+    Write(data.blocks, writer);
+    writer.Key("cnt-runs");
+    Write(data.cnt_runs, writer);
+    writer.EndObject();
+}
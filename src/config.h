@@ -16,6 +16,22 @@ public:
     int runner_timer_interval_ms;
     int scheduler_max_payload_length;
     int scheduler_idle_timeout_s;
+    int scheduler_threads;
+    int scheduler_max_retries;
+    int scheduler_retry_backoff_ms;
+    int scheduler_snapshot_interval;
+    int scheduler_workflow_ttl_s;
+    int scheduler_max_workflows;
+    int scheduler_memory_budget_mb;
+    int scheduler_locality_wait_ms;
+    int scheduler_max_batch_payload_length;
+    int scheduler_speculation_factor;
+    int runner_wire_version;
+    int scheduler_client_batch_ms;
+    int scheduler_client_replay_events;
+    int log_level;
+    int scheduler_max_templates;
+    int scheduler_max_cached_results;
 
     static Config &Get() {
         static Config config;
@@ -45,6 +61,34 @@ inline rapidjson::Value Serialize<Config>(const Config &data,
                     Serialize(data.scheduler_max_payload_length, alloc), alloc);
     value.AddMember("scheduler_idle_timeout_s", Serialize(data.scheduler_idle_timeout_s, alloc),
                     alloc);
+    value.AddMember("scheduler_threads", Serialize(data.scheduler_threads, alloc), alloc);
+    value.AddMember("scheduler_max_retries", Serialize(data.scheduler_max_retries, alloc), alloc);
+    value.AddMember("scheduler_retry_backoff_ms", Serialize(data.scheduler_retry_backoff_ms, alloc),
+                    alloc);
+    value.AddMember("scheduler_snapshot_interval",
+                    Serialize(data.scheduler_snapshot_interval, alloc), alloc);
+    value.AddMember("scheduler_workflow_ttl_s", Serialize(data.scheduler_workflow_ttl_s, alloc),
+                    alloc);
+    value.AddMember("scheduler_max_workflows", Serialize(data.scheduler_max_workflows, alloc),
+                    alloc);
+    value.AddMember("scheduler_memory_budget_mb", Serialize(data.scheduler_memory_budget_mb, alloc),
+                    alloc);
+    value.AddMember("scheduler_locality_wait_ms", Serialize(data.scheduler_locality_wait_ms, alloc),
+                    alloc);
+    value.AddMember("scheduler_max_batch_payload_length",
+                    Serialize(data.scheduler_max_batch_payload_length, alloc), alloc);
+    value.AddMember("scheduler_speculation_factor",
+                    Serialize(data.scheduler_speculation_factor, alloc), alloc);
+    value.AddMember("runner_wire_version", Serialize(data.runner_wire_version, alloc), alloc);
+    value.AddMember("scheduler_client_batch_ms", Serialize(data.scheduler_client_batch_ms, alloc),
+                    alloc);
+    value.AddMember("scheduler_client_replay_events",
+                    Serialize(data.scheduler_client_replay_events, alloc), alloc);
+    value.AddMember("log_level", Serialize(data.log_level, alloc), alloc);
+    value.AddMember("scheduler_max_templates", Serialize(data.scheduler_max_templates, alloc),
+                    alloc);
+    value.AddMember("scheduler_max_cached_results",
+                    Serialize(data.scheduler_max_cached_results, alloc), alloc);
     return value;
 }
 
@@ -56,6 +100,73 @@ inline void Deserialize<Config>(Config &data, const rapidjson::Value &value) {
     Deserialize(data.runner_timer_interval_ms, value["runner_timer_interval_ms"]);
     Deserialize(data.scheduler_max_payload_length, value["scheduler_max_payload_length"]);
     Deserialize(data.scheduler_idle_timeout_s, value["scheduler_idle_timeout_s"]);
+    Deserialize(data.scheduler_threads, value["scheduler_threads"]);
+    Deserialize(data.scheduler_max_retries, value["scheduler_max_retries"]);
+    Deserialize(data.scheduler_retry_backoff_ms, value["scheduler_retry_backoff_ms"]);
+    Deserialize(data.scheduler_snapshot_interval, value["scheduler_snapshot_interval"]);
+    Deserialize(data.scheduler_workflow_ttl_s, value["scheduler_workflow_ttl_s"]);
+    Deserialize(data.scheduler_max_workflows, value["scheduler_max_workflows"]);
+    Deserialize(data.scheduler_memory_budget_mb, value["scheduler_memory_budget_mb"]);
+    Deserialize(data.scheduler_locality_wait_ms, value["scheduler_locality_wait_ms"]);
+    Deserialize(data.scheduler_max_batch_payload_length,
+                value["scheduler_max_batch_payload_length"]);
+    Deserialize(data.scheduler_speculation_factor, value["scheduler_speculation_factor"]);
+    Deserialize(data.runner_wire_version, value["runner_wire_version"]);
+    Deserialize(data.scheduler_client_batch_ms, value["scheduler_client_batch_ms"]);
+    Deserialize(data.scheduler_client_replay_events, value["scheduler_client_replay_events"]);
+    Deserialize(data.log_level, value["log_level"]);
+    Deserialize(data.scheduler_max_templates, value["scheduler_max_templates"]);
+    Deserialize(data.scheduler_max_cached_results, value["scheduler_max_cached_results"]);
+}
+
+template <>
+inline void Write<Config>(const Config &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("host");
+    Write(data.host, writer);
+    writer.Key("port");
+    Write(data.port, writer);
+    writer.Key("runner_reconnect_interval_ms");
+    Write(data.runner_reconnect_interval_ms, writer);
+    writer.Key("runner_timer_interval_ms");
+    Write(data.runner_timer_interval_ms, writer);
+    writer.Key("scheduler_max_payload_length");
+    Write(data.scheduler_max_payload_length, writer);
+    writer.Key("scheduler_idle_timeout_s");
+    Write(data.scheduler_idle_timeout_s, writer);
+    writer.Key("scheduler_threads");
+    Write(data.scheduler_threads, writer);
+    writer.Key("scheduler_max_retries");
+    Write(data.scheduler_max_retries, writer);
+    writer.Key("scheduler_retry_backoff_ms");
+    Write(data.scheduler_retry_backoff_ms, writer);
+    writer.Key("scheduler_snapshot_interval");
+    Write(data.scheduler_snapshot_interval, writer);
+    writer.Key("scheduler_workflow_ttl_s");
+    Write(data.scheduler_workflow_ttl_s, writer);
+    writer.Key("scheduler_max_workflows");
+    Write(data.scheduler_max_workflows, writer);
+    writer.Key("scheduler_memory_budget_mb");
+    Write(data.scheduler_memory_budget_mb, writer);
+    writer.Key("scheduler_locality_wait_ms");
+    Write(data.scheduler_locality_wait_ms, writer);
+    writer.Key("scheduler_max_batch_payload_length");
+    Write(data.scheduler_max_batch_payload_length, writer);
+    writer.Key("scheduler_speculation_factor");
+    Write(data.scheduler_speculation_factor, writer);
+    writer.Key("runner_wire_version");
+    Write(data.runner_wire_version, writer);
+    writer.Key("scheduler_client_batch_ms");
+    Write(data.scheduler_client_batch_ms, writer);
+    writer.Key("scheduler_client_replay_events");
+    Write(data.scheduler_client_replay_events, writer);
+    writer.Key("log_level");
+    Write(data.log_level, writer);
+    writer.Key("scheduler_max_templates");
+    Write(data.scheduler_max_templates, writer);
+    writer.Key("scheduler_max_cached_results");
+    Write(data.scheduler_max_cached_results, writer);
+    writer.EndObject();
 }
 
 inline void Config::Load() {
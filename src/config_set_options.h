@@ -38,6 +38,54 @@ public:
         desc.add_options()("scheduler-idle-timeout-s",
                            po::value<int>(&Config::Get().scheduler_idle_timeout_s),
                            "time limit after which network connections are automatically closed");
+        desc.add_options()("scheduler-threads",
+                           po::value<int>(&Config::Get().scheduler_threads),
+                           "number of scheduler event loops, 0 to use all hardware threads");
+        desc.add_options()("scheduler-max-retries",
+                           po::value<int>(&Config::Get().scheduler_max_retries),
+                           "number of times a block is requeued after its runner disconnects");
+        desc.add_options()("scheduler-retry-backoff-ms",
+                           po::value<int>(&Config::Get().scheduler_retry_backoff_ms),
+                           "delay before the first requeue of a block, doubled on every next one "
+                           "up to a minute");
+        desc.add_options()("scheduler-snapshot-interval",
+                           po::value<int>(&Config::Get().scheduler_snapshot_interval),
+                           "number of journaled events between snapshots");
+        desc.add_options()("scheduler-workflow-ttl-s",
+                           po::value<int>(&Config::Get().scheduler_workflow_ttl_s),
+                           "seconds after which an idle workflow is archived, and then forgotten");
+        desc.add_options()("scheduler-max-workflows",
+                           po::value<int>(&Config::Get().scheduler_max_workflows),
+                           "maximum number of workflows kept in memory");
+        desc.add_options()("scheduler-memory-budget-mb",
+                           po::value<int>(&Config::Get().scheduler_memory_budget_mb),
+                           "memory budget for workflows kept in memory");
+        desc.add_options()("scheduler-locality-wait-ms",
+                           po::value<int>(&Config::Get().scheduler_locality_wait_ms),
+                           "time a block waits for a runner on the node holding its inputs");
+        desc.add_options()("scheduler-max-batch-payload-length",
+                           po::value<int>(&Config::Get().scheduler_max_batch_payload_length),
+                           "maximum body length of a batch submission");
+        desc.add_options()("scheduler-speculation-factor",
+                           po::value<int>(&Config::Get().scheduler_speculation_factor),
+                           "copy blocks running this many times longer than expected");
+        desc.add_options()("runner-wire-version",
+                           po::value<int>(&Config::Get().runner_wire_version),
+                           "binary protocol version offered to the scheduler, 0 for JSON");
+        desc.add_options()("scheduler-client-batch-ms",
+                           po::value<int>(&Config::Get().scheduler_client_batch_ms),
+                           "batch block updates to clients over this many ms, 0 to send each");
+        desc.add_options()("scheduler-client-replay-events",
+                           po::value<int>(&Config::Get().scheduler_client_replay_events),
+                           "number of recent workflow events kept for clients that reconnect");
+        desc.add_options()("log-level", po::value<int>(&Config::Get().log_level),
+                           "lowest level of logged messages: 0 debug, 1 info, 2 warning, 3 error");
+        desc.add_options()("scheduler-max-templates",
+                           po::value<int>(&Config::Get().scheduler_max_templates),
+                           "templates kept in memory, the others are loaded on use");
+        desc.add_options()("scheduler-max-cached-results",
+                           po::value<int>(&Config::Get().scheduler_max_cached_results),
+                           "maximum number of cached block results kept in memory");
         po::variables_map vm;
         try {
             po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
@@ -26,3 +26,17 @@ inline void Deserialize<Connection>(Connection &data, const rapidjson::Value &va
     Deserialize(data.target_block_id, value["target-block-id"]);
     Deserialize(data.target_input_id, value["target-input-id"]);
 }
+
+template <>
+inline void Write<Connection>(const Connection &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("source-block-id");
+    Write(data.source_block_id, writer);
+    writer.Key("source-output-id");
+    Write(data.source_output_id, writer);
+    writer.Key("target-block-id");
+    Write(data.target_block_id, writer);
+    writer.Key("target-input-id");
+    Write(data.target_input_id, writer);
+    writer.EndObject();
+}
@@ -2,8 +2,12 @@
 
 #include <cstdint>
 #include <optional>
+#include <string>
+#include <string_view>
 
+#include "json_reader.h"
 #include "serialize.h"
+#include "wire.h"
 
 struct Constraints {
     std::optional<int64_t> time_limit_ms, wall_time_limit_ms, memory_limit_kb, fsize_limit_kb;
@@ -56,3 +60,76 @@ inline void Deserialize<Constraints>(Constraints &data, const rapidjson::Value &
         Deserialize(data.max_threads, value["max-threads"]);
     }
 }
+
+template <>
+inline void Write<Constraints>(const Constraints &data, JSONWriter &writer) {
+    writer.StartObject();
+    if (data.time_limit_ms.has_value()) {
+        writer.Key("time-limit-ms");
+        Write(data.time_limit_ms, writer);
+    }
+    if (data.wall_time_limit_ms.has_value()) {
+        writer.Key("wall-time-limit-ms");
+        Write(data.wall_time_limit_ms, writer);
+    }
+    if (data.memory_limit_kb.has_value()) {
+        writer.Key("memory-limit-kb");
+        Write(data.memory_limit_kb, writer);
+    }
+    if (data.fsize_limit_kb.has_value()) {
+        writer.Key("fsize-limit-kb");
+        Write(data.fsize_limit_kb, writer);
+    }
+    if (data.max_files.has_value()) {
+        writer.Key("max-files");
+        Write(data.max_files, writer);
+    }
+    if (data.max_threads.has_value()) {
+        writer.Key("max-threads");
+        Write(data.max_threads, writer);
+    }
+    writer.EndObject();
+}
+
+template <>
+inline void Read<Constraints>(Constraints &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "time-limit-ms") {
+            Read(data.time_limit_ms, reader);
+        } else if (key == "wall-time-limit-ms") {
+            Read(data.wall_time_limit_ms, reader);
+        } else if (key == "memory-limit-kb") {
+            Read(data.memory_limit_kb, reader);
+        } else if (key == "fsize-limit-kb") {
+            Read(data.fsize_limit_kb, reader);
+        } else if (key == "max-files") {
+            Read(data.max_files, reader);
+        } else if (key == "max-threads") {
+            Read(data.max_threads, reader);
+        } else {
+            reader.Skip();
+        }
+    }
+}
+
+template <>
+inline void Encode<Constraints>(const Constraints &data, std::string &out) {
+    Encode(data.time_limit_ms, out);
+    Encode(data.wall_time_limit_ms, out);
+    Encode(data.memory_limit_kb, out);
+    Encode(data.fsize_limit_kb, out);
+    Encode(data.max_files, out);
+    Encode(data.max_threads, out);
+}
+
+template <>
+inline void Decode<Constraints>(Constraints &data, WireReader &reader) {
+    Decode(data.time_limit_ms, reader);
+    Decode(data.wall_time_limit_ms, reader);
+    Decode(data.memory_limit_kb, reader);
+    Decode(data.fsize_limit_kb, reader);
+    Decode(data.max_files, reader);
+    Decode(data.max_threads, reader);
+}
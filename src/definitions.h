@@ -3,22 +3,40 @@
 #define HTTP_BAD_REQUEST "400 Bad Request"
 #define HTTP_NOT_FOUND "404 Not Found"
 #define HTTP_REQUEST_ENTITY_TOO_LARGE "413 Request Entity Too Large"
+#define HTTP_INTERNAL_SERVER_ERROR "500 Internal Server Error"
 
 #define SUBMIT_ACCEPTED "accepted"
 #define SUBMIT_PARSE_ERROR "parse error"
 #define SUBMIT_VALIDATION_ERROR "validation error"
+#define SUBMIT_INTERNAL_ERROR "internal error"
 
 #define DUPLICATED_PATH_ERROR "duplicated path"
 #define INVALID_CONNECTION_ERROR "invalid connection"
+#define INVALID_STREAM_ERROR "invalid streaming output"
+#define UNDEFINED_PARAMETER_ERROR "undefined parameter"
+#define INVALID_PARAMETERS_ERROR "parameters must be an object of strings"
+#define MISPLACED_PARAMETER_ERROR "parameters are only allowed in argv, env and bind outside paths"
 #define UNDEFINED_COMMAND_ERROR "undefined command"
-#define NOT_IMPLEMENTED_ERROR "not implemented"
 #define ALREADY_RUNNING_ERROR "workflow is already running"
+#define NOT_RUNNING_ERROR "workflow is not running"
+#define CANCELLED_ERROR "cancelled"
+#define TASK_TERMINATED_ERROR "task process terminated unexpectedly"
+#define RUNNER_LOST_ERROR "runner disconnected"
+#define ARCHIVED_ERROR "workflow is archived"
+#define JSON_FORMAT_ERROR "malformed JSON message"
+#define WIRE_FORMAT_ERROR "malformed binary message"
+#define WIRE_VERSION_ERROR "unsupported binary message version"
 
 #define BLOCK_SIGNAL "block"
+#define BLOCK_BATCH_SIGNAL "batch"
+#define CANCEL_SIGNAL "cancel"
 #define ERROR_SIGNAL "error"
+#define EVENT_SIGNAL "event"
 #define RUN_SIGNAL "run"
+#define SNAPSHOT_SIGNAL "snapshot"
 #define STOP_SIGNAL "stop"
 #define WORKFLOW_SIGNAL "workflow"
 
 #define RUNNING_STATE "running"
+#define RETRYING_STATE "retrying"
 #define FINISHED_STATE "finished"
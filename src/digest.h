@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+inline uint64_t RotateLeft(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+// XXH64 by Yann Collet, see https://github.com/Cyan4973/xxHash.
+inline uint64_t XXH64(std::string_view data, uint64_t seed) {
+    constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+    constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+    auto read64 = [](const char *ptr) {
+        uint64_t value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
+    };
+    auto read32 = [](const char *ptr) {
+        uint32_t value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
+    };
+    auto round = [](uint64_t acc, uint64_t input) {
+        return RotateLeft(acc + input * kPrime2, 31) * kPrime1;
+    };
+    auto merge = [&](uint64_t acc, uint64_t value) {
+        return (acc ^ round(0, value)) * kPrime1 + kPrime4;
+    };
+    const char *ptr = data.data(), *end = data.data() + data.size();
+    uint64_t hash;
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2, v2 = seed + kPrime2, v3 = seed, v4 = seed - kPrime1;
+        for (; ptr + 32 <= end; ptr += 32) {
+            v1 = round(v1, read64(ptr));
+            v2 = round(v2, read64(ptr + 8));
+            v3 = round(v3, read64(ptr + 16));
+            v4 = round(v4, read64(ptr + 24));
+        }
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+    } else {
+        hash = seed + kPrime5;
+    }
+    hash += data.size();
+    for (; ptr + 8 <= end; ptr += 8) {
+        hash = RotateLeft(hash ^ round(0, read64(ptr)), 27) * kPrime1 + kPrime4;
+    }
+    if (ptr + 4 <= end) {
+        hash = RotateLeft(hash ^ (read32(ptr) * kPrime1), 23) * kPrime2 + kPrime3;
+        ptr += 4;
+    }
+    for (; ptr < end; ++ptr) {
+        hash = RotateLeft(hash ^ (static_cast<uint8_t>(*ptr) * kPrime5), 11) * kPrime1;
+    }
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// 128-bit digest of a sequence of length-prefixed strings, built from two seeded XXH64 passes.
+class Digest {
+public:
+    void Update(std::string_view data) {
+        uint64_t size = data.size();
+        buffer_.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        buffer_.append(data);
+    }
+
+    std::string Hex() const {
+        return HexOf(buffer_);
+    }
+
+    static std::string HexOf(std::string_view data) {
+        static const char kHexDigits[] = "0123456789abcdef";
+        std::string hex;
+        for (uint64_t seed : {kSeed1, kSeed2}) {
+            uint64_t hash = XXH64(data, seed);
+            for (int shift = 60; shift >= 0; shift -= 4) {
+                hex.push_back(kHexDigits[(hash >> shift) & 15]);
+            }
+        }
+        return hex;
+    }
+
+private:
+    static constexpr uint64_t kSeed1 = 0, kSeed2 = 0x5851F42D4C957F2DULL;
+    std::string buffer_;
+};
+
+inline std::string DigestFile(const fs::path &path) {
+    // Contents are hashed in chunks, and the digests of the chunks are combined, so that large
+    // files are never loaded into memory at once.
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw fs::filesystem_error("cannot open file", path,
+                                   std::make_error_code(std::errc::permission_denied));
+    }
+    Digest digest;
+    std::string chunk(1 << 20, '\0');
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        digest.Update(Digest::HexOf(std::string_view(chunk.data(), file.gcount())));
+    }
+    return digest.Hex();
+}
+
+inline std::string DigestPath(
+    const fs::path &path,
+    const std::function<std::string(const fs::path &)> &digest_file = DigestFile) {
+    if (!fs::is_directory(path)) {
+        return digest_file(path);
+    }
+    std::vector<fs::path> entries;
+    for (const auto &entry : fs::recursive_directory_iterator(path)) {
+        entries.push_back(entry.path());
+    }
+    std::sort(entries.begin(), entries.end());
+    Digest digest;
+    for (const auto &entry : entries) {
+        digest.Update(fs::relative(entry, path).string());
+        digest.Update(fs::is_directory(entry) ? "" : digest_file(entry));
+    }
+    return digest.Hex();
+}
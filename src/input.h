@@ -23,3 +23,13 @@ inline void Deserialize<Input>(Input &data, const rapidjson::Value &value) {
     Deserialize(data.path, value["path"]);
     Deserialize(data.cached, value["cached"]);
 }
+
+template <>
+inline void Write<Input>(const Input &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("path");
+    Write(data.path, writer);
+    writer.Key("cached");
+    Write(data.cached, writer);
+    writer.EndObject();
+}
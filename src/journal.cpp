@@ -0,0 +1,179 @@
+#include <charconv>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "json.h"
+#include "journal.h"
+#include "logger.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Parses "<shard>-<generation>.snapshot", the part of a snapshot name after the epoch.
+bool ParseFileName(std::string_view name, size_t &shard_id, size_t &generation) {
+    name.remove_suffix(std::string_view(".snapshot").size());
+    const char *end = name.data() + name.size();
+    auto [shard_end, shard_error] = std::from_chars(name.data(), end, shard_id);
+    if (shard_error != std::errc() || shard_end == end || *shard_end != '-') {
+        return false;
+    }
+    auto [generation_end, generation_error] = std::from_chars(shard_end + 1, end, generation);
+    return generation_error == std::errc() && generation_end == end;
+}
+
+}  // namespace
+
+Journal::Journal(const fs::path &dir, size_t epoch, size_t shard_id)
+    : dir_(dir), epoch_(epoch), shard_id_(shard_id) {
+    fs::create_directories(dir_);
+}
+
+void Journal::Append(const JournalEvent &event) {
+    // Events are flushed to the page cache one by one, so that a crash of the scheduler process
+    // loses nothing, while a crash of the whole machine may lose the last few of them.
+    out_ << ToJSON(event) << '\n';
+    out_.flush();
+    ++cnt_events_;
+}
+
+size_t Journal::CountEvents() const {
+    return cnt_events_;
+}
+
+void Journal::WriteSnapshot(std::vector<WorkflowSnapshot> workflows,
+                            std::vector<ArchivedWorkflow> archived) {
+    // The log of the next generation is started before the snapshot that refers to it is
+    // written, so that either of the two is always complete. The previous generation is kept
+    // until the next snapshot, in case this one turns out to be unreadable.
+    size_t generation = generation_ + 1;
+    out_.close();
+    out_.open(GetJournalPath(dir_, epoch_, shard_id_, generation), std::ios::trunc);
+    fs::path snapshot_path = GetSnapshotPath(dir_, epoch_, shard_id_, generation);
+    fs::path tmp_path = snapshot_path.string() + ".tmp";
+    {
+        ShardSnapshot snapshot = {.generation = generation,
+                                  .workflows = std::move(workflows),
+                                  .archived = std::move(archived)};
+        // A snapshot is written through a buffer of its own rather than the reusable one, which
+        // would otherwise stay as large as the whole shard.
+        rapidjson::StringBuffer buffer;
+        JSONWriter writer(buffer);
+        Write(snapshot, writer);
+        std::ofstream snapshot_file(tmp_path, std::ios::trunc);
+        snapshot_file.write(buffer.GetString(), buffer.GetSize());
+    }
+    fs::rename(tmp_path, snapshot_path);
+    if (generation_ > 0) {
+        std::error_code error;
+        fs::remove(GetSnapshotPath(dir_, epoch_, shard_id_, generation_ - 1), error);
+        fs::remove(GetJournalPath(dir_, epoch_, shard_id_, generation_ - 1), error);
+    }
+    generation_ = generation;
+    cnt_events_ = 0;
+}
+
+size_t Journal::ReadEpoch(const fs::path &dir) {
+    std::ifstream epoch_file(dir / "CURRENT");
+    size_t epoch = 0;
+    epoch_file >> epoch;
+    return epoch;
+}
+
+void Journal::WriteEpoch(const fs::path &dir, size_t epoch) {
+    fs::create_directories(dir);
+    {
+        std::ofstream epoch_file(dir / "CURRENT.tmp", std::ios::trunc);
+        epoch_file << epoch << '\n';
+    }
+    fs::rename(dir / "CURRENT.tmp", dir / "CURRENT");
+}
+
+void Journal::ReadEpochShards(const fs::path &dir, size_t epoch,
+                              std::vector<ShardSnapshot> &snapshots,
+                              std::vector<std::vector<JournalEvent>> &events) {
+    if (!fs::is_directory(dir)) {
+        return;
+    }
+    std::string prefix = GetPrefix(epoch);
+    std::map<size_t, std::set<size_t>> generations;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        if (!name.starts_with(prefix) || !name.ends_with(".snapshot")) {
+            continue;
+        }
+        size_t shard_id, generation;
+        if (!ParseFileName(std::string_view(name).substr(prefix.size()), shard_id, generation)) {
+            LogWarning("Journal: ignored stray file ", name);
+            continue;
+        }
+        generations[shard_id].insert(generation);
+    }
+    // A shard is restored from its latest readable snapshot, followed by the events of that
+    // generation and of every later one.
+    for (const auto &[shard_id, shard_generations] : generations) {
+        size_t last_generation = *shard_generations.rbegin();
+        for (auto iter = shard_generations.rbegin(); iter != shard_generations.rend(); ++iter) {
+            fs::path snapshot_path = GetSnapshotPath(dir, epoch, shard_id, *iter);
+            auto document = ReadJSON(snapshot_path.string());
+            if (document.HasParseError()) {
+                LogWarning("Journal: snapshot ", snapshot_path.string(),
+                           " is unreadable, falling back to the previous generation");
+                continue;
+            }
+            Deserialize(snapshots.emplace_back(), document);
+            auto &shard_events = events.emplace_back();
+            for (size_t generation = *iter; generation <= last_generation; ++generation) {
+                ReadEvents(GetJournalPath(dir, epoch, shard_id, generation), shard_events);
+            }
+            break;
+        }
+    }
+}
+
+void Journal::RemoveOtherEpochs(const fs::path &dir, size_t epoch) {
+    std::string prefix = GetPrefix(epoch);
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        if (name != "CURRENT" && !name.starts_with(prefix)) {
+            fs::remove_all(entry.path());
+        }
+    }
+}
+
+std::string Journal::GetPrefix(size_t epoch) {
+    return std::to_string(epoch) + "-";
+}
+
+fs::path Journal::GetJournalPath(const fs::path &dir, size_t epoch, size_t shard_id,
+                                 size_t generation) {
+    return dir / (GetPrefix(epoch) + std::to_string(shard_id) + "-" + std::to_string(generation) +
+                  ".journal");
+}
+
+fs::path Journal::GetSnapshotPath(const fs::path &dir, size_t epoch, size_t shard_id,
+                                  size_t generation) {
+    return dir / (GetPrefix(epoch) + std::to_string(shard_id) + "-" + std::to_string(generation) +
+                  ".snapshot");
+}
+
+void Journal::ReadEvents(const fs::path &path, std::vector<JournalEvent> &events) {
+    std::ifstream journal_file(path);
+    std::string line;
+    while (std::getline(journal_file, line)) {
+        // The last line is torn if the scheduler was killed in the middle of writing it.
+        auto event_document = ParseJSON(line);
+        if (event_document.HasParseError()) {
+            break;
+        }
+        Deserialize(events.emplace_back(), event_document);
+    }
+}
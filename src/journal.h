@@ -0,0 +1,235 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "archived_workflow.h"
+#include "block_state.h"
+#include "run_response.h"
+#include "serialize.h"
+#include "workflow.h"
+
+#define SUBMIT_EVENT "submit"
+#define RUN_EVENT "run"
+#define STOP_EVENT "stop"
+#define DISPATCH_EVENT "dispatch"
+#define FINISH_EVENT "finish"
+#define ARCHIVE_EVENT "archive"
+#define EXPIRE_EVENT "expire"
+
+namespace fs = std::filesystem;
+
+struct JournalEvent {
+    std::string type;
+    std::string workflow_id;
+    std::optional<Workflow> workflow;
+    std::optional<size_t> block_id;
+    std::optional<std::string> container_path;
+    std::optional<std::string> node;
+    std::optional<RunResponse> response;
+};
+
+struct WorkflowSnapshot {
+    std::string workflow_id;
+    Workflow workflow;
+    bool is_running, is_stopping;
+    size_t cnt_workflow_runs;
+    std::vector<BlockState> blocks_state;
+    std::vector<size_t> blocks_ready, blocks_processing;
+};
+
+struct ShardSnapshot {
+    size_t generation;
+    std::vector<WorkflowSnapshot> workflows;
+    std::vector<ArchivedWorkflow> archived;
+};
+
+template <>
+inline rapidjson::Value Serialize<JournalEvent>(const JournalEvent &data,
+                                                rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("type", Serialize(data.type, alloc), alloc);
+    value.AddMember("workflow-id", Serialize(data.workflow_id, alloc), alloc);
+    if (data.workflow.has_value()) {
+        value.AddMember("workflow", Serialize(data.workflow, alloc), alloc);
+    }
+    if (data.block_id.has_value()) {
+        value.AddMember("block-id", Serialize(data.block_id, alloc), alloc);
+    }
+    if (data.container_path.has_value()) {
+        value.AddMember("container-path", Serialize(data.container_path, alloc), alloc);
+    }
+    if (data.node.has_value()) {
+        value.AddMember("node", Serialize(data.node, alloc), alloc);
+    }
+    if (data.response.has_value()) {
+        value.AddMember("response", Serialize(data.response, alloc), alloc);
+    }
+    return value;
+}
+
+template <>
+inline void Deserialize<JournalEvent>(JournalEvent &data, const rapidjson::Value &value) {
+    Deserialize(data.type, value["type"]);
+    Deserialize(data.workflow_id, value["workflow-id"]);
+    if (value.HasMember("workflow")) {
+        Deserialize(data.workflow, value["workflow"]);
+    }
+    if (value.HasMember("block-id")) {
+        Deserialize(data.block_id, value["block-id"]);
+    }
+    if (value.HasMember("container-path")) {
+        Deserialize(data.container_path, value["container-path"]);
+    }
+    if (value.HasMember("node")) {
+        Deserialize(data.node, value["node"]);
+    }
+    if (value.HasMember("response")) {
+        Deserialize(data.response, value["response"]);
+    }
+}
+
+template <>
+inline void Write<JournalEvent>(const JournalEvent &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("type");
+    Write(data.type, writer);
+    writer.Key("workflow-id");
+    Write(data.workflow_id, writer);
+    if (data.workflow.has_value()) {
+        writer.Key("workflow");
+        Write(data.workflow, writer);
+    }
+    if (data.block_id.has_value()) {
+        writer.Key("block-id");
+        Write(data.block_id, writer);
+    }
+    if (data.container_path.has_value()) {
+        writer.Key("container-path");
+        Write(data.container_path, writer);
+    }
+    if (data.node.has_value()) {
+        writer.Key("node");
+        Write(data.node, writer);
+    }
+    if (data.response.has_value()) {
+        writer.Key("response");
+        Write(data.response, writer);
+    }
+    writer.EndObject();
+}
+
+template <>
+inline rapidjson::Value Serialize<WorkflowSnapshot>(const WorkflowSnapshot &data,
+                                                    rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("workflow-id", Serialize(data.workflow_id, alloc), alloc);
+    value.AddMember("workflow", Serialize(data.workflow, alloc), alloc);
+    value.AddMember("is-running", Serialize(data.is_running, alloc), alloc);
+    value.AddMember("is-stopping", Serialize(data.is_stopping, alloc), alloc);
+    value.AddMember("cnt-workflow-runs", Serialize(data.cnt_workflow_runs, alloc), alloc);
+    value.AddMember("blocks-state", Serialize(data.blocks_state, alloc), alloc);
+    value.AddMember("blocks-ready", Serialize(data.blocks_ready, alloc), alloc);
+    value.AddMember("blocks-processing", Serialize(data.blocks_processing, alloc), alloc);
+    return value;
+}
+
+template <>
+inline void Deserialize<WorkflowSnapshot>(WorkflowSnapshot &data, const rapidjson::Value &value) {
+    Deserialize(data.workflow_id, value["workflow-id"]);
+    Deserialize(data.workflow, value["workflow"]);
+    Deserialize(data.is_running, value["is-running"]);
+    Deserialize(data.is_stopping, value["is-stopping"]);
+    Deserialize(data.cnt_workflow_runs, value["cnt-workflow-runs"]);
+    Deserialize(data.blocks_state, value["blocks-state"]);
+    Deserialize(data.blocks_ready, value["blocks-ready"]);
+    Deserialize(data.blocks_processing, value["blocks-processing"]);
+}
+
+template <>
+inline void Write<WorkflowSnapshot>(const WorkflowSnapshot &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("workflow-id");
+    Write(data.workflow_id, writer);
+    writer.Key("workflow");
+    Write(data.workflow, writer);
+    writer.Key("is-running");
+    Write(data.is_running, writer);
+    writer.Key("is-stopping");
+    Write(data.is_stopping, writer);
+    writer.Key("cnt-workflow-runs");
+    Write(data.cnt_workflow_runs, writer);
+    writer.Key("blocks-state");
+    Write(data.blocks_state, writer);
+    writer.Key("blocks-ready");
+    Write(data.blocks_ready, writer);
+    writer.Key("blocks-processing");
+    Write(data.blocks_processing, writer);
+    writer.EndObject();
+}
+
+template <>
+inline rapidjson::Value Serialize<ShardSnapshot>(const ShardSnapshot &data,
+                                                 rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("generation", Serialize(data.generation, alloc), alloc);
+    value.AddMember("workflows", Serialize(data.workflows, alloc), alloc);
+    value.AddMember("archived", Serialize(data.archived, alloc), alloc);
+    return value;
+}
+
+template <>
+inline void Deserialize<ShardSnapshot>(ShardSnapshot &data, const rapidjson::Value &value) {
+    Deserialize(data.generation, value["generation"]);
+    Deserialize(data.workflows, value["workflows"]);
+    Deserialize(data.archived, value["archived"]);
+}
+
+template <>
+inline void Write<ShardSnapshot>(const ShardSnapshot &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("generation");
+    Write(data.generation, writer);
+    writer.Key("workflows");
+    Write(data.workflows, writer);
+    writer.Key("archived");
+    Write(data.archived, writer);
+    writer.EndObject();
+}
+
+// Append-only log of the events of a shard, one JSON document per line, that together with the
+// last snapshot of the shard is enough to rebuild its workflows after a restart. Every start of
+// the scheduler begins a new epoch, and every snapshot begins a new generation of the log.
+class Journal {
+public:
+    Journal(const fs::path &dir, size_t epoch, size_t shard_id);
+
+    void Append(const JournalEvent &event);
+    size_t CountEvents() const;
+    void WriteSnapshot(std::vector<WorkflowSnapshot> workflows,
+                       std::vector<ArchivedWorkflow> archived);
+
+    static size_t ReadEpoch(const fs::path &dir);
+    static void WriteEpoch(const fs::path &dir, size_t epoch);
+    static void ReadEpochShards(const fs::path &dir, size_t epoch,
+                                std::vector<ShardSnapshot> &snapshots,
+                                std::vector<std::vector<JournalEvent>> &events);
+    static void RemoveOtherEpochs(const fs::path &dir, size_t epoch);
+
+private:
+    fs::path dir_;
+    size_t epoch_, shard_id_;
+    size_t generation_ = 0, cnt_events_ = 0;
+    std::ofstream out_;
+
+    static std::string GetPrefix(size_t epoch);
+    static fs::path GetJournalPath(const fs::path &dir, size_t epoch, size_t shard_id,
+                                   size_t generation);
+    static fs::path GetSnapshotPath(const fs::path &dir, size_t epoch, size_t shard_id,
+                                    size_t generation);
+    static void ReadEvents(const fs::path &path, std::vector<JournalEvent> &events);
+};
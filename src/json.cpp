@@ -15,10 +15,10 @@ rapidjson::Document ParseJSON(const std::string &text) {
     return document;
 }
 
-std::string StringifyJSON(const rapidjson::Document &document) {
+std::string StringifyJSON(const rapidjson::Value &value) {
     rapidjson::StringBuffer buffer;
     rapidjson::Writer writer(buffer);
-    document.Accept(writer);
+    value.Accept(writer);
     return buffer.GetString();
 }
 
@@ -38,6 +38,44 @@ void WriteJSON(const rapidjson::Document &document, const std::string &path) {
     document.Accept(writer);
 }
 
+void AppendEscapedJSON(std::string &out, std::string_view text) {
+    // Contents of a JSON string literal, escaped the same way as rapidjson writes them.
+    static const char kHexDigits[] = "0123456789ABCDEF";
+    for (char c : text) {
+        switch (c) {
+            case '"':
+                out.append("\\\"");
+                break;
+            case '\\':
+                out.append("\\\\");
+                break;
+            case '\b':
+                out.append("\\b");
+                break;
+            case '\f':
+                out.append("\\f");
+                break;
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(kHexDigits[c >> 4]);
+                    out.push_back(kHexDigits[c & 15]);
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+}
+
 std::string FormattedError(const rapidjson::Document &document) {
     return std::string(rapidjson::GetParseError_En(document.GetParseError())) + " (at position " +
            std::to_string(document.GetErrorOffset()) + ")";
@@ -57,11 +95,15 @@ rapidjson::Document SchemaValidator::ParseAndValidate(const std::string &text) {
     if (document.HasParseError()) {
         throw ParseError(FormattedError(document));
     }
+    Validate(document);
+    return document;
+}
+
+void SchemaValidator::Validate(const rapidjson::Value &value) {
     schema_validator_->Reset();
-    if (!document.Accept(*schema_validator_)) {
+    if (!value.Accept(*schema_validator_)) {
         rapidjson::Document error;
         error.CopyFrom(schema_validator_->GetError(), error.GetAllocator());
         throw ValidationError(StringifyJSON(error));
     }
-    return document;
 }
@@ -2,19 +2,23 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
 #include <rapidjson/document.h>
 #include <rapidjson/schema.h>
 
 rapidjson::Document ParseJSON(const std::string &text);
-std::string StringifyJSON(const rapidjson::Document &document);
+std::string StringifyJSON(const rapidjson::Value &value);
 rapidjson::Document ReadJSON(const std::string &path);
 void WriteJSON(const rapidjson::Document &document, const std::string &path);
+std::string FormattedError(const rapidjson::Document &document);
+void AppendEscapedJSON(std::string &out, std::string_view text);
 
 class SchemaValidator {
 public:
     explicit SchemaValidator(const std::string &schema_path);
 
     rapidjson::Document ParseAndValidate(const std::string &text);
+    void Validate(const rapidjson::Value &value);
 
 private:
     std::optional<rapidjson::SchemaDocument> schema_document_;
@@ -0,0 +1,160 @@
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+#include "definitions.h"
+#include "error.h"
+#include "json_reader.h"
+
+JSONReader::JSONReader(std::string_view text) : stream_(text.data(), text.size()) {
+    handler_.reader_ptr = this;
+    reader_.IterativeParseInit();
+}
+
+JSONReader::Token JSONReader::Peek() {
+    if (!peeked_) {
+        // Every step of the reader that does not fail reports exactly one token, and the one that
+        // reports the end of the root value also completes the parsing.
+        if (reader_.IterativeParseComplete() ||
+            !reader_.IterativeParseNext<rapidjson::kParseDefaultFlags>(stream_, handler_)) {
+            throw ParseError(JSON_FORMAT_ERROR);
+        }
+        peeked_ = true;
+    }
+    return token_;
+}
+
+JSONReader::Token JSONReader::Next() {
+    Token token = Peek();
+    peeked_ = false;
+    return token;
+}
+
+void JSONReader::Expect(Token token) {
+    if (Next() != token) {
+        throw ParseError(JSON_FORMAT_ERROR);
+    }
+}
+
+bool JSONReader::NextKey() {
+    Token token = Next();
+    if (token == Token::kEndObject) {
+        return false;
+    }
+    if (token != Token::kKey) {
+        throw ParseError(JSON_FORMAT_ERROR);
+    }
+    return true;
+}
+
+void JSONReader::Skip() {
+    size_t depth = 0;
+    do {
+        Token token = Next();
+        if (token == Token::kStartObject || token == Token::kStartArray) {
+            ++depth;
+        } else if (token == Token::kEndObject || token == Token::kEndArray) {
+            --depth;
+        }
+    } while (depth > 0);
+}
+
+bool JSONReader::GetBool() const {
+    return bool_;
+}
+
+int64_t JSONReader::GetInt64() const {
+    if (token_ == Token::kInt) {
+        return int_;
+    }
+    if (token_ == Token::kUint && uint_ <= std::numeric_limits<int64_t>::max()) {
+        return static_cast<int64_t>(uint_);
+    }
+    throw ParseError(JSON_FORMAT_ERROR);
+}
+
+uint64_t JSONReader::GetUint64() const {
+    if (token_ == Token::kUint) {
+        return uint_;
+    }
+    if (token_ == Token::kInt && int_ >= 0) {
+        return static_cast<uint64_t>(int_);
+    }
+    throw ParseError(JSON_FORMAT_ERROR);
+}
+
+std::string_view JSONReader::GetString() const {
+    return string_;
+}
+
+bool JSONReader::Handler::Null() {
+    reader_ptr->token_ = Token::kNull;
+    return true;
+}
+
+bool JSONReader::Handler::Bool(bool value) {
+    reader_ptr->token_ = Token::kBool;
+    reader_ptr->bool_ = value;
+    return true;
+}
+
+bool JSONReader::Handler::Int(int value) {
+    return Int64(value);
+}
+
+bool JSONReader::Handler::Uint(unsigned value) {
+    return Uint64(value);
+}
+
+bool JSONReader::Handler::Int64(int64_t value) {
+    reader_ptr->token_ = Token::kInt;
+    reader_ptr->int_ = value;
+    return true;
+}
+
+bool JSONReader::Handler::Uint64(uint64_t value) {
+    reader_ptr->token_ = Token::kUint;
+    reader_ptr->uint_ = value;
+    return true;
+}
+
+bool JSONReader::Handler::Double(double value) {
+    reader_ptr->token_ = Token::kDouble;
+    return true;
+}
+
+bool JSONReader::Handler::String(const char *str, rapidjson::SizeType length, bool copy) {
+    // The reader reuses the memory of the string for the next one, so it is kept in a buffer
+    // that is reused the same way.
+    reader_ptr->token_ = Token::kString;
+    reader_ptr->string_.assign(str, length);
+    return true;
+}
+
+bool JSONReader::Handler::Key(const char *str, rapidjson::SizeType length, bool copy) {
+    reader_ptr->token_ = Token::kKey;
+    reader_ptr->string_.assign(str, length);
+    return true;
+}
+
+bool JSONReader::Handler::StartObject() {
+    reader_ptr->token_ = Token::kStartObject;
+    return true;
+}
+
+bool JSONReader::Handler::EndObject(rapidjson::SizeType cnt_members) {
+    reader_ptr->token_ = Token::kEndObject;
+    return true;
+}
+
+bool JSONReader::Handler::StartArray() {
+    reader_ptr->token_ = Token::kStartArray;
+    return true;
+}
+
+bool JSONReader::Handler::EndArray(rapidjson::SizeType cnt_elements) {
+    reader_ptr->token_ = Token::kEndArray;
+    return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+
+// Pulls the tokens of a JSON text one at a time out of the SAX reader of rapidjson, so that hot
+// messages are read straight into their structs, with no DOM in between and no copy of the text.
+class JSONReader {
+public:
+    enum class Token {
+        kNull,
+        kBool,
+        kInt,
+        kUint,
+        kDouble,
+        kString,
+        kKey,
+        kStartObject,
+        kEndObject,
+        kStartArray,
+        kEndArray,
+    };
+
+    explicit JSONReader(std::string_view text);
+
+    Token Peek();
+    Token Next();
+    void Expect(Token token);
+    bool NextKey();
+    void Skip();
+
+    bool GetBool() const;
+    int64_t GetInt64() const;
+    uint64_t GetUint64() const;
+    // Valid until the next token is read.
+    std::string_view GetString() const;
+
+private:
+    struct Handler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, Handler> {
+        JSONReader *reader_ptr;
+
+        bool Null();
+        bool Bool(bool value);
+        bool Int(int value);
+        bool Uint(unsigned value);
+        bool Int64(int64_t value);
+        bool Uint64(uint64_t value);
+        bool Double(double value);
+        bool String(const char *str, rapidjson::SizeType length, bool copy);
+        bool Key(const char *str, rapidjson::SizeType length, bool copy);
+        bool StartObject();
+        bool EndObject(rapidjson::SizeType cnt_members);
+        bool StartArray();
+        bool EndArray(rapidjson::SizeType cnt_elements);
+    };
+
+    rapidjson::MemoryStream stream_;
+    rapidjson::Reader reader_;
+    Handler handler_;
+    Token token_ = Token::kNull;
+    bool peeked_ = false;
+    bool bool_ = false;
+    int64_t int_ = 0;
+    uint64_t uint_ = 0;
+    std::string string_;
+};
+
+template <class T>
+void Read(T &data, JSONReader &reader);
+
+template <class T>
+void FromJSON(T &data, std::string_view text) {
+    JSONReader reader(text);
+    Read(data, reader);
+}
+
+// bool
+template <>
+inline void Read<bool>(bool &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kBool);
+    data = reader.GetBool();
+}
+
+// int
+template <>
+inline void Read<int>(int &data, JSONReader &reader) {
+    reader.Next();
+    data = static_cast<int>(reader.GetInt64());
+}
+
+// int64_t
+template <>
+inline void Read<int64_t>(int64_t &data, JSONReader &reader) {
+    reader.Next();
+    data = reader.GetInt64();
+}
+
+// size_t
+template <>
+inline void Read<size_t>(size_t &data, JSONReader &reader) {
+    reader.Next();
+    data = reader.GetUint64();
+}
+
+// std::string
+template <>
+inline void Read<std::string>(std::string &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kString);
+    data = reader.GetString();
+}
+
+// std::optional
+template <class T>
+void Read(std::optional<T> &data, JSONReader &reader) {
+    if (reader.Peek() == JSONReader::Token::kNull) {
+        reader.Next();
+        data.reset();
+    } else {
+        data.template emplace<>();
+        Read(data.value(), reader);
+    }
+}
+
+// std::vector
+template <class T>
+void Read(std::vector<T> &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartArray);
+    data.clear();
+    while (reader.Peek() != JSONReader::Token::kEndArray) {
+        Read(data.emplace_back(), reader);
+    }
+    reader.Next();
+}
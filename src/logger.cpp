@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+class Logger::Timestamps {
+public:
+    // Local time is only worked out once per second, since records come in bursts.
+    std::string_view Get(std::chrono::system_clock::time_point time) {
+        time_t second = std::chrono::system_clock::to_time_t(time);
+        if (second != second_) {
+            tm local_time;
+            localtime_r(&second, &local_time);
+            size_ = strftime(text_, sizeof(text_), "%F %T", &local_time);
+            second_ = second;
+        }
+        return {text_, size_};
+    }
+
+private:
+    time_t second_ = -1;
+    char text_[32] = {};
+    size_t size_ = 0;
+};
+
+namespace {
+
+std::string_view GetLevelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::kDebug:
+            return "debug: ";
+        case LogLevel::kWarning:
+            return "warning: ";
+        case LogLevel::kError:
+            return "error: ";
+        default:
+            return "";
+    }
+}
+
+template <class T>
+T DecodeNumber(std::string_view &args) {
+    T value;
+    memcpy(&value, args.data(), sizeof(value));
+    args.remove_prefix(sizeof(value));
+    return value;
+}
+
+void DecodeLogArgs(std::string_view args, std::string &out) {
+    char buffer[24];
+    while (!args.empty()) {
+        auto type = static_cast<LogArgType>(args.front());
+        args.remove_prefix(1);
+        if (type == LogArgType::kText) {
+            size_t size = DecodeNumber<size_t>(args);
+            out += args.substr(0, size);
+            args.remove_prefix(size);
+        } else if (type == LogArgType::kSigned) {
+            auto value = DecodeNumber<int64_t>(args);
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        } else {
+            auto value = DecodeNumber<uint64_t>(args);
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        }
+    }
+}
+
+}  // namespace
+
+Logger::Logger() : slots_(new Slot[kCapacity]) {
+    for (size_t i = 0; i < kCapacity; ++i) {
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+void Logger::SetName(const std::string &name) {
+    name_ = name;
+}
+
+void Logger::SetLevel(int level) {
+    level_.store(static_cast<LogLevel>(std::clamp(level, 0, static_cast<int>(LogLevel::kError))),
+                 std::memory_order_relaxed);
+}
+
+void Logger::Start() {
+    if (!started_.exchange(true)) {
+        writer_ = std::thread(&Logger::RunWriter, this);
+    }
+}
+
+void Logger::Stop() {
+    // Records queued by then are written before Stop returns, the ones that come later are
+    // written right away.
+    if (started_.exchange(false)) {
+        stopping_.store(true, std::memory_order_release);
+        writer_.join();
+        stopping_.store(false, std::memory_order_relaxed);
+        // Threads that saw the logger running may have pushed records after the writer returned,
+        // so those are written here, waiting for the slots that have been claimed to be filled.
+        Timestamps timestamps;
+        std::string batch;
+        Record record;
+        while (tail_ != head_.load(std::memory_order_acquire)) {
+            if (Pop(record)) {
+                Format(record, timestamps, batch);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        FormatDropped(timestamps, batch);
+        WriteAll(batch);
+    }
+}
+
+void Logger::Print(LogLevel level, std::string args) {
+    Record record = {
+        .time = std::chrono::system_clock::now(), .level = level, .args = std::move(args)};
+    if (!started_.load(std::memory_order_acquire)) {
+        Timestamps timestamps;
+        std::string line;
+        Format(record, timestamps, line);
+        WriteAll(line);
+        return;
+    }
+    if (!Push(record)) {
+        cnt_dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Logger::~Logger() {
+    Stop();
+}
+
+// Bounded multi-producer queue: every slot carries the position it may be written at next, and
+// the position after it once it holds a record, so producers claim slots with a single CAS and
+// the writer never waits for them.
+bool Logger::Push(Record &record) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+        Slot &slot = slots_[pos % kCapacity];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == pos) {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.record = std::move(record);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (seq < pos) {
+            return false;
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Logger::Pop(Record &record) {
+    Slot &slot = slots_[tail_ % kCapacity];
+    if (slot.seq.load(std::memory_order_acquire) != tail_ + 1) {
+        return false;
+    }
+    record = std::move(slot.record);
+    slot.seq.store(tail_ + kCapacity, std::memory_order_release);
+    ++tail_;
+    return true;
+}
+
+void Logger::RunWriter() {
+    // Signals are left to the other threads, since their handlers exit and wait for this one.
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    Timestamps timestamps;
+    std::string batch;
+    Record record;
+    while (true) {
+        bool stopping = stopping_.load(std::memory_order_acquire);
+        while (batch.size() < kMaxBatchSize && Pop(record)) {
+            Format(record, timestamps, batch);
+        }
+        FormatDropped(timestamps, batch);
+        if (!batch.empty()) {
+            WriteAll(batch);
+            batch.clear();
+        } else if (stopping) {
+            return;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(kFlushIntervalMs));
+        }
+    }
+}
+
+void Logger::Format(const Record &record, Timestamps &timestamps, std::string &out) const {
+    out += timestamps.Get(record.time);
+    out += " [";
+    out += name_;
+    out += "] ";
+    out += GetLevelName(record.level);
+    DecodeLogArgs(record.args, out);
+    out += '\n';
+}
+
+void Logger::FormatDropped(Timestamps &timestamps, std::string &out) {
+    if (size_t cnt_dropped = cnt_dropped_.exchange(0, std::memory_order_relaxed)) {
+        Format({.time = std::chrono::system_clock::now(),
+                .level = LogLevel::kWarning,
+                .args = EncodeLogArgs("dropped ", cnt_dropped, " log messages")},
+               timestamps, out);
+    }
+}
+
+void Logger::WriteAll(std::string_view text) {
+    while (!text.empty()) {
+        ssize_t written = write(STDERR_FILENO, text.data(), text.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        text.remove_prefix(written);
+    }
+}
@@ -1,12 +1,32 @@
 #pragma once
 
-#include <ctime>
-#include <iomanip>
-#include <iostream>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <utility>
 
+// Messages below this level are compiled out.
+#ifndef MIN_LOG_LEVEL
+#define MIN_LOG_LEVEL 0
+#endif
+
+enum class LogLevel { kDebug, kInfo, kWarning, kError };
+
+enum class LogArgType : char { kText, kSigned, kUnsigned };
+
+// Records are handed to a bounded lock-free queue and written by a background thread in batches,
+// so that logging costs the calling thread one copy of its arguments and no I/O. A record is
+// dropped when the queue is full rather than the caller being blocked, and the number of dropped
+// records is logged in their place. Until Start is called and after Stop, records are written
+// right away.
 class Logger {
 public:
     static Logger &Get() {
@@ -14,32 +34,126 @@ public:
         return logger;
     }
 
-    void SetName(const std::string &name) {
-        name_ = name;
-    }
+    void SetName(const std::string &name);
+    void SetLevel(int level);
+    void Start();
+    void Stop();
 
-    void Print(std::ostream &out, const std::string &text) {
-        time_t now = time(nullptr);
-        std::stringstream ss;
-        ss << std::put_time(localtime(&now), "%F %T");
-        ss << " [" << name_ << "] " << text << "\n";
-        out << ss.str();
-        out.flush();
+    bool IsEnabled(LogLevel level) const {
+        return level >= level_.load(std::memory_order_relaxed);
     }
 
+    // Takes the arguments encoded by EncodeLogArgs.
+    void Print(LogLevel level, std::string args);
+
+    ~Logger();
+
 private:
+    struct Record {
+        std::chrono::system_clock::time_point time;
+        LogLevel level;
+        std::string args;
+    };
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        Record record;
+    };
+
+    class Timestamps;
+
     std::string name_;
-    Logger() = default;
+    std::atomic<LogLevel> level_ = LogLevel::kInfo;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic<size_t> head_ = 0;
+    size_t tail_ = 0;
+    std::atomic<size_t> cnt_dropped_ = 0;
+    std::atomic<bool> started_ = false, stopping_ = false;
+    std::thread writer_;
+
+    static constexpr size_t kCapacity = 1 << 14;
+    static constexpr size_t kMaxBatchSize = 1 << 16;
+    static constexpr int kFlushIntervalMs = 10;
+
+    Logger();
+
+    bool Push(Record &record);
+    bool Pop(Record &record);
+    void RunWriter();
+    void Format(const Record &record, Timestamps &timestamps, std::string &out) const;
+    void FormatDropped(Timestamps &timestamps, std::string &out);
+    static void WriteAll(std::string_view text);
 };
 
+// Arguments are kept in a binary form tagged with their type and only turned into text on the
+// writer thread, so that numbers cost the calling thread a copy rather than a conversion. Types
+// without an encoding of their own are formatted right away.
+inline void EncodeLogText(std::string &out, std::string_view text) {
+    size_t size = text.size();
+    out += static_cast<char>(LogArgType::kText);
+    out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    out += text;
+}
+
+template <class T>
+inline void EncodeLogArg(std::string &out, T &&arg) {
+    using U = std::remove_cvref_t<T>;
+    if constexpr (std::is_invocable_v<U>) {
+        // Expensive arguments are passed as callables, which are only run for enabled messages.
+        EncodeLogArg(out, arg());
+    } else if constexpr (std::is_convertible_v<const U &, std::string_view>) {
+        EncodeLogText(out, std::string_view(arg));
+    } else if constexpr (std::is_same_v<U, char>) {
+        EncodeLogText(out, std::string_view(&arg, 1));
+    } else if constexpr (std::is_same_v<U, bool>) {
+        EncodeLogText(out, arg ? "1" : "0");
+    } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+        int64_t value = arg;
+        out += static_cast<char>(LogArgType::kSigned);
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    } else if constexpr (std::is_integral_v<U>) {
+        uint64_t value = arg;
+        out += static_cast<char>(LogArgType::kUnsigned);
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    } else {
+        std::ostringstream ss;
+        ss << arg;
+        EncodeLogText(out, ss.str());
+    }
+}
+
+template <class... Args>
+inline std::string EncodeLogArgs(Args &&...args) {
+    std::string out;
+    (EncodeLogArg(out, std::forward<Args>(args)), ...);
+    return out;
+}
+
+template <LogLevel level, class... Args>
+inline void LogAt(Args &&...args) {
+    if constexpr (static_cast<int>(level) >= MIN_LOG_LEVEL) {
+        if (Logger::Get().IsEnabled(level)) {
+            Logger::Get().Print(level, EncodeLogArgs(std::forward<Args>(args)...));
+        }
+    }
+}
+
+template <class... Args>
+inline void LogDebug(Args &&...args) {
+    LogAt<LogLevel::kDebug>(std::forward<Args>(args)...);
+}
+
+template <class... Args>
+inline void Log(Args &&...args) {
+    LogAt<LogLevel::kInfo>(std::forward<Args>(args)...);
+}
+
 template <class... Args>
-inline std::string JoinToString(Args... args) {
-    std::stringstream ss;
-    ((ss << args), ...);
-    return ss.str();
+inline void LogWarning(Args &&...args) {
+    LogAt<LogLevel::kWarning>(std::forward<Args>(args)...);
 }
 
 template <class... Args>
-inline void Log(Args... args) {
-    Logger::Get().Print(std::clog, JoinToString(std::forward<Args>(args)...));
+inline void LogError(Args &&...args) {
+    LogAt<LogLevel::kError>(std::forward<Args>(args)...);
 }
@@ -7,6 +7,7 @@
 struct Meta {
     std::string name, partition;
     int max_runners;
+    int weight = 1;
 };
 
 template <>
@@ -16,6 +17,7 @@ inline rapidjson::Value Serialize<Meta>(const Meta &data,
     value.AddMember("name", Serialize(data.name, alloc), alloc);
     value.AddMember("partition", Serialize(data.partition, alloc), alloc);
     value.AddMember("max-runners", Serialize(data.max_runners, alloc), alloc);
+    value.AddMember("weight", Serialize(data.weight, alloc), alloc);
     return value;
 }
 
@@ -24,4 +26,21 @@ inline void Deserialize<Meta>(Meta &data, const rapidjson::Value &value) {
     Deserialize(data.name, value["name"]);
     Deserialize(data.partition, value["partition"]);
     Deserialize(data.max_runners, value["max-runners"]);
+    if (value.HasMember("weight")) {
+        Deserialize(data.weight, value["weight"]);
+    }
+}
+
+template <>
+inline void Write<Meta>(const Meta &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("name");
+    Write(data.name, writer);
+    writer.Key("partition");
+    Write(data.partition, writer);
+    writer.Key("max-runners");
+    Write(data.max_runners, writer);
+    writer.Key("weight");
+    Write(data.weight, writer);
+    writer.EndObject();
 }
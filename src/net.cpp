@@ -1,3 +1,9 @@
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "net.h"
 
 HttpSession::HttpSession(const std::string &host, int port) : host_(host), stream_(ioc_) {
@@ -24,7 +30,7 @@ HttpSession::~HttpSession() {
     stream_.socket().shutdown(ip::tcp::socket::shutdown_both, ec);
 }
 
-WebsocketClientSession::WebsocketClientSession() : ws_(ioc_) {
+WebsocketClientSession::WebsocketClientSession() : ws_(ioc_), timer_(ioc_) {
 }
 
 void WebsocketClientSession::Connect(const std::string &host, int port, const std::string &target) {
@@ -35,9 +41,49 @@ void WebsocketClientSession::Connect(const std::string &host, int port, const st
 }
 
 void WebsocketClientSession::Write(const std::string &message) {
+    ws_.text(true);
     ws_.write(asio::buffer(message));
 }
 
+void WebsocketClientSession::Send(std::string message, bool binary) {
+    // Safe to call from any thread. Messages are written by the thread running the session, one
+    // batch at a time, so that frames of different messages never interleave on the socket.
+    std::lock_guard<std::mutex> lock(outbox_mutex_);
+    outbox_.push_back({.data = std::move(message), .binary = binary});
+    if (!flushing_) {
+        flushing_ = true;
+        asio::post(ioc_, [this] { Flush(); });
+    }
+}
+
+void WebsocketClientSession::Flush() {
+    {
+        std::lock_guard<std::mutex> lock(outbox_mutex_);
+        batch_.clear();
+        batch_.swap(outbox_);
+        if (batch_.empty()) {
+            flushing_ = false;
+            return;
+        }
+    }
+    WriteBatch(0);
+}
+
+void WebsocketClientSession::WriteBatch(size_t position) {
+    if (position == batch_.size()) {
+        Flush();
+        return;
+    }
+    ws_.binary(batch_[position].binary);
+    ws_.async_write(asio::buffer(batch_[position].data),
+                    [this, position](const beast::error_code &ec, size_t bytes_written) {
+                        if (ec) {
+                            throw beast::system_error(ec);
+                        }
+                        WriteBatch(position + 1);
+                    });
+}
+
 void WebsocketClientSession::OnRead(std::function<void(std::string)> handler) {
     ws_.template async_read<>(buffer_, [this, handler = std::move(handler)](
                                            const beast::error_code &ec, size_t bytes_written) {
@@ -51,6 +97,18 @@ void WebsocketClientSession::OnRead(std::function<void(std::string)> handler) {
     });
 }
 
+void WebsocketClientSession::OnTimer(int interval_ms, std::function<void()> handler) {
+    timer_.expires_after(std::chrono::milliseconds(interval_ms));
+    timer_.async_wait(
+        [this, interval_ms, handler = std::move(handler)](const beast::error_code &ec) {
+            if (ec) {
+                return;
+            }
+            handler();
+            OnTimer(interval_ms, handler);
+        });
+}
+
 void WebsocketClientSession::Run() {
     ioc_.run();
 }
@@ -74,7 +132,8 @@ std::string WebsocketServerSession::Read() {
     return beast::buffers_to_string(buffer.data());
 }
 
-void WebsocketServerSession::Write(const std::string &message) {
+void WebsocketServerSession::Write(const std::string &message, bool binary) {
+    ws_.binary(binary);
     ws_.write(boost::asio::buffer(message));
 }
 
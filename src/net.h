@@ -1,7 +1,9 @@
 #pragma once
 
 #include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <boost/beast.hpp>
 
 namespace asio = boost::asio;
@@ -31,7 +33,9 @@ public:
     void Connect(const std::string &host, int port, const std::string &target);
 
     void Write(const std::string &message);
+    void Send(std::string message, bool binary = false);
     void OnRead(std::function<void(std::string)> handler);
+    void OnTimer(int interval_ms, std::function<void()> handler);
 
     void Run();
     void Stop();
@@ -42,6 +46,18 @@ private:
     asio::io_context ioc_;
     websocket::stream<ip::tcp::socket> ws_;
     beast::flat_buffer buffer_;
+    asio::steady_timer timer_;
+    struct OutboundMessage {
+        std::string data;
+        bool binary;
+    };
+
+    std::mutex outbox_mutex_;
+    std::vector<OutboundMessage> outbox_, batch_;
+    bool flushing_ = false;
+
+    void Flush();
+    void WriteBatch(size_t position);
 };
 
 class WebsocketServerSession {
@@ -49,7 +65,7 @@ public:
     WebsocketServerSession(websocket::stream<beast::tcp_stream> ws);
 
     std::string Read();
-    void Write(const std::string &message);
+    void Write(const std::string &message, bool binary = false);
 
     ~WebsocketServerSession();
 
@@ -6,6 +6,7 @@
 
 struct Output {
     std::string path;
+    bool streaming = false;
 };
 
 template <>
@@ -13,10 +14,24 @@ inline rapidjson::Value Serialize<Output>(const Output &data,
                                           rapidjson::Document::AllocatorType &alloc) {
     rapidjson::Value value(rapidjson::kObjectType);
     value.AddMember("path", Serialize(data.path, alloc), alloc);
+    value.AddMember("streaming", Serialize(data.streaming, alloc), alloc);
     return value;
 }
 
 template <>
 inline void Deserialize<Output>(Output &data, const rapidjson::Value &value) {
     Deserialize(data.path, value["path"]);
+    if (value.HasMember("streaming")) {
+        Deserialize(data.streaming, value["streaming"]);
+    }
+}
+
+template <>
+inline void Write<Output>(const Output &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("path");
+    Write(data.path, writer);
+    writer.Key("streaming");
+    Write(data.streaming, writer);
+    writer.EndObject();
 }
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "json_reader.h"
+#include "serialize.h"
+#include "wire.h"
+
+struct OutputFile {
+    std::string path;
+    int64_t size;
+    int64_t mtime_ns;
+};
+
+template <>
+inline rapidjson::Value Serialize<OutputFile>(const OutputFile &data,
+                                              rapidjson::Document::AllocatorType &alloc) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("path", Serialize(data.path, alloc), alloc);
+    value.AddMember("size", Serialize(data.size, alloc), alloc);
+    value.AddMember("mtime-ns", Serialize(data.mtime_ns, alloc), alloc);
+    return value;
+}
+
+template <>
+inline void Deserialize<OutputFile>(OutputFile &data, const rapidjson::Value &value) {
+    Deserialize(data.path, value["path"]);
+    Deserialize(data.size, value["size"]);
+    Deserialize(data.mtime_ns, value["mtime-ns"]);
+}
+
+template <>
+inline void Write<OutputFile>(const OutputFile &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("path");
+    Write(data.path, writer);
+    writer.Key("size");
+    Write(data.size, writer);
+    writer.Key("mtime-ns");
+    Write(data.mtime_ns, writer);
+    writer.EndObject();
+}
+
+template <>
+inline void Read<OutputFile>(OutputFile &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "path") {
+            Read(data.path, reader);
+        } else if (key == "size") {
+            Read(data.size, reader);
+        } else if (key == "mtime-ns") {
+            Read(data.mtime_ns, reader);
+        } else {
+            reader.Skip();
+        }
+    }
+}
+
+template <>
+inline void Encode<OutputFile>(const OutputFile &data, std::string &out) {
+    Encode(data.path, out);
+    Encode(data.size, out);
+    Encode(data.mtime_ns, out);
+}
+
+template <>
+inline void Decode<OutputFile>(OutputFile &data, WireReader &reader) {
+    Decode(data.path, reader);
+    Decode(data.size, reader);
+    Decode(data.mtime_ns, reader);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "constraints.h"
+
+struct Resources {
+    int64_t cpus, memory_kb, threads;
+
+    Resources &operator+=(const Resources &other) {
+        cpus += other.cpus;
+        memory_kb += other.memory_kb;
+        threads += other.threads;
+        return *this;
+    }
+
+    Resources &operator-=(const Resources &other) {
+        cpus -= other.cpus;
+        memory_kb -= other.memory_kb;
+        threads -= other.threads;
+        return *this;
+    }
+
+    bool Fits(const Resources &capacity) const {
+        return cpus <= capacity.cpus && memory_kb <= capacity.memory_kb &&
+               threads <= capacity.threads;
+    }
+};
+
+inline Resources GetDemand(const Constraints &constraints) {
+    return {.cpus = 1,
+            .memory_kb = constraints.memory_limit_kb.value_or(0),
+            .threads = constraints.max_threads.value_or(1)};
+}
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "digest.h"
+#include "result_cache.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+size_t GetMemoryUsage(const std::string &key, const CachedResult &result) {
+    size_t memory_usage = 2 * key.size() + sizeof(CachedResult) + result.container_path.size() +
+                          result.node.size() + sizeof(RunStatus);
+    for (const auto &output_digest : result.output_digests) {
+        memory_usage += sizeof(std::string) + output_digest.size();
+    }
+    for (const auto &output_file : result.manifest) {
+        memory_usage += sizeof(OutputFile) + output_file.path.size();
+    }
+    return memory_usage;
+}
+
+size_t GetMemoryUsage(const std::string &path, const std::string &digest) {
+    return 2 * path.size() + digest.size() + sizeof(uintmax_t) + sizeof(fs::file_time_type);
+}
+
+}  // namespace
+
+std::optional<CachedResult> ResultCache::Find(const std::string &key) {
+    std::lock_guard lock(mutex_);
+    auto iter = results_.find(key);
+    if (iter == results_.end()) {
+        return std::nullopt;
+    }
+    if (!fs::exists(iter->second.result.container_path)) {
+        EraseResult(iter);
+        return std::nullopt;
+    }
+    results_order_.splice(results_order_.end(), results_order_, iter->second.position);
+    return iter->second.result;
+}
+
+void ResultCache::Insert(const std::string &key, const CachedResult &result) {
+    std::lock_guard lock(mutex_);
+    if (auto iter = results_.find(key); iter != results_.end()) {
+        EraseResult(iter);
+    }
+    results_order_.push_back(key);
+    size_t memory_usage = ::GetMemoryUsage(key, result);
+    results_[key] = {.result = result,
+                     .memory_usage = memory_usage,
+                     .position = std::prev(results_order_.end())};
+    memory_usage_ += memory_usage;
+    Evict();
+}
+
+size_t ResultCache::GetMemoryUsage() const {
+    return memory_usage_.load(std::memory_order_relaxed);
+}
+
+std::string ResultCache::GetContentDigest(const fs::path &path) {
+    return DigestPath(path, [this](const fs::path &file_path) { return GetFileDigest(file_path); });
+}
+
+std::string ResultCache::GetMetadataDigest(const fs::path &path) {
+    // Editing a file does not touch the directories above it, so a directory is identified by
+    // the metadata of everything inside, in a fixed order.
+    auto update = [](Digest &digest, const fs::path &entry_path, const std::string &name) {
+        digest.Update(name);
+        auto mtime = fs::last_write_time(entry_path).time_since_epoch().count();
+        digest.Update(std::to_string(mtime));
+        if (fs::is_regular_file(entry_path)) {
+            digest.Update(std::to_string(fs::file_size(entry_path)));
+        }
+    };
+    Digest digest;
+    update(digest, path, fs::absolute(path).string());
+    if (fs::is_directory(path)) {
+        std::vector<fs::path> entry_paths;
+        for (const auto &entry : fs::recursive_directory_iterator(path)) {
+            entry_paths.push_back(entry.path());
+        }
+        std::sort(entry_paths.begin(), entry_paths.end());
+        for (const auto &entry_path : entry_paths) {
+            update(digest, entry_path, entry_path.lexically_relative(path).string());
+        }
+    }
+    return digest.Hex();
+}
+
+std::string ResultCache::GetFileDigest(const fs::path &path) {
+    // Digests are reused while size and modification time of the file stay the same.
+    uintmax_t size = fs::file_size(path);
+    fs::file_time_type mtime = fs::last_write_time(path);
+    {
+        std::lock_guard lock(mutex_);
+        auto iter = file_digests_.find(path.string());
+        if (iter != file_digests_.end() && iter->second.size == size &&
+            iter->second.mtime == mtime) {
+            return iter->second.digest;
+        }
+    }
+    std::string digest = DigestFile(path);
+    std::lock_guard lock(mutex_);
+    if (auto iter = file_digests_.find(path.string()); iter != file_digests_.end()) {
+        EraseFileDigest(iter);
+    }
+    file_digests_order_.push_back(path.string());
+    file_digests_[path.string()] = {.size = size,
+                                    .mtime = mtime,
+                                    .digest = digest,
+                                    .position = std::prev(file_digests_order_.end())};
+    memory_usage_ += ::GetMemoryUsage(path.string(), digest);
+    Evict();
+    return digest;
+}
+
+void ResultCache::EraseResult(std::unordered_map<std::string, Entry>::iterator iter) {
+    memory_usage_ -= iter->second.memory_usage;
+    results_order_.erase(iter->second.position);
+    results_.erase(iter);
+}
+
+void ResultCache::EraseFileDigest(std::unordered_map<std::string, FileDigest>::iterator iter) {
+    memory_usage_ -= ::GetMemoryUsage(iter->first, iter->second.digest);
+    file_digests_order_.erase(iter->second.position);
+    file_digests_.erase(iter);
+}
+
+void ResultCache::Evict() {
+    // The least recently used entries go first, while there are more of either kind than
+    // scheduler_max_cached_results or the cache takes over half the memory budget, so that the
+    // rest of the budget is left to workflows. File digests go before results, since a lost
+    // digest costs reading a file again and a lost result costs running a block again.
+    size_t max_entries = std::max(Config::Get().scheduler_max_cached_results, 1);
+    size_t memory_budget =
+        (static_cast<size_t>(Config::Get().scheduler_memory_budget_mb) << 20) / 2;
+    while (file_digests_.size() > max_entries ||
+           (!file_digests_.empty() && memory_usage_ > memory_budget)) {
+        EraseFileDigest(file_digests_.find(file_digests_order_.front()));
+    }
+    while (results_.size() > max_entries ||
+           (!results_.empty() && memory_usage_ > memory_budget)) {
+        EraseResult(results_.find(results_order_.front()));
+    }
+}
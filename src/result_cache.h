@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "output_file.h"
+#include "run_status.h"
+
+namespace fs = std::filesystem;
+
+struct CachedResult {
+    std::string container_path;
+    std::string node;
+    RunStatus status;
+    std::vector<std::string> output_digests;
+    std::vector<OutputFile> manifest;
+};
+
+// Results of successful runs of cacheable blocks, keyed by the digest of everything the run
+// depends on. Shared between the scheduler event loops. Only the recently used results and file
+// digests are kept, and the memory they take is charged against the scheduler memory budget.
+class ResultCache {
+public:
+    static ResultCache &Get() {
+        static ResultCache cache;
+        return cache;
+    }
+
+    std::optional<CachedResult> Find(const std::string &key);
+    void Insert(const std::string &key, const CachedResult &result);
+
+    std::string GetContentDigest(const fs::path &path);
+    std::string GetMetadataDigest(const fs::path &path);
+
+    size_t GetMemoryUsage() const;
+
+private:
+    struct Entry {
+        CachedResult result;
+        size_t memory_usage;
+        std::list<std::string>::iterator position;
+    };
+
+    struct FileDigest {
+        uintmax_t size;
+        fs::file_time_type mtime;
+        std::string digest;
+        std::list<std::string>::iterator position;
+    };
+
+    std::mutex mutex_;
+    std::list<std::string> results_order_;
+    std::unordered_map<std::string, Entry> results_;
+    std::list<std::string> file_digests_order_;
+    std::unordered_map<std::string, FileDigest> file_digests_;
+    std::atomic<size_t> memory_usage_ = 0;
+
+    ResultCache() = default;
+
+    std::string GetFileDigest(const fs::path &path);
+    void EraseResult(std::unordered_map<std::string, Entry>::iterator iter);
+    void EraseFileDigest(std::unordered_map<std::string, FileDigest>::iterator iter);
+    void Evict();
+};
@@ -1,32 +1,106 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "bind.h"
 #include "constraints.h"
+#include "json_reader.h"
 #include "serialize.h"
+#include "wire.h"
 
 struct RunRequest {
+    size_t task_id;
     std::vector<Bind> binds;
     std::vector<std::string> argv, env;
     Constraints constraints;
+    std::vector<std::string> outputs;
 };
 
 template <>
 inline rapidjson::Value Serialize<RunRequest>(const RunRequest &data,
                                               rapidjson::Document::AllocatorType &alloc) {
     rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("task-id", Serialize(data.task_id, alloc), alloc);
     value.AddMember("binds", Serialize(data.binds, alloc), alloc);
     value.AddMember("argv", Serialize(data.argv, alloc), alloc);
     value.AddMember("env", Serialize(data.env, alloc), alloc);
     value.AddMember("constraints", Serialize(data.constraints, alloc), alloc);
+    value.AddMember("outputs", Serialize(data.outputs, alloc), alloc);
     return value;
 }
 
 template <>
 inline void Deserialize<RunRequest>(RunRequest &data, const rapidjson::Value &value) {
+    Deserialize(data.task_id, value["task-id"]);
     Deserialize(data.binds, value["binds"]);
     Deserialize(data.argv, value["argv"]);
     Deserialize(data.env, value["env"]);
     Deserialize(data.constraints, value["constraints"]);
+    if (value.HasMember("outputs")) {
+        Deserialize(data.outputs, value["outputs"]);
+    }
+}
+
+template <>
+inline void Write<RunRequest>(const RunRequest &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("task-id");
+    Write(data.task_id, writer);
+    writer.Key("binds");
+    Write(data.binds, writer);
+    writer.Key("argv");
+    Write(data.argv, writer);
+    writer.Key("env");
+    Write(data.env, writer);
+    writer.Key("constraints");
+    Write(data.constraints, writer);
+    writer.Key("outputs");
+    Write(data.outputs, writer);
+    writer.EndObject();
+}
+
+template <>
+inline void Read<RunRequest>(RunRequest &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "task-id") {
+            Read(data.task_id, reader);
+        } else if (key == "binds") {
+            Read(data.binds, reader);
+        } else if (key == "argv") {
+            Read(data.argv, reader);
+        } else if (key == "env") {
+            Read(data.env, reader);
+        } else if (key == "constraints") {
+            Read(data.constraints, reader);
+        } else if (key == "outputs") {
+            Read(data.outputs, reader);
+        } else {
+            reader.Skip();
+        }
+    }
+}
+
+template <>
+inline void Encode<RunRequest>(const RunRequest &data, std::string &out) {
+    Encode(data.task_id, out);
+    Encode(data.binds, out);
+    Encode(data.argv, out);
+    Encode(data.env, out);
+    Encode(data.constraints, out);
+    Encode(data.outputs, out);
+}
+
+template <>
+inline void Decode<RunRequest>(RunRequest &data, WireReader &reader) {
+    Decode(data.task_id, reader);
+    Decode(data.binds, reader);
+    Decode(data.argv, reader);
+    Decode(data.env, reader);
+    Decode(data.constraints, reader);
+    Decode(data.outputs, reader);
 }
@@ -1,35 +1,121 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <vector>
 
+#include "json_reader.h"
+#include "output_file.h"
 #include "run_status.h"
 #include "serialize.h"
+#include "wire.h"
 
 struct RunResponse {
+    size_t task_id;
     std::optional<std::string> error;
     std::optional<RunStatus> status;
+    std::vector<std::string> output_digests;
+    std::vector<OutputFile> manifest;
 };
 
 template <>
 inline rapidjson::Value Serialize<RunResponse>(const RunResponse &data,
                                                rapidjson::Document::AllocatorType &alloc) {
     rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("task-id", Serialize(data.task_id, alloc), alloc);
     if (data.error.has_value()) {
         value.AddMember("error", Serialize(data.error, alloc), alloc);
     }
     if (data.status.has_value()) {
         value.AddMember("status", Serialize(data.status, alloc), alloc);
     }
+    if (!data.output_digests.empty()) {
+        value.AddMember("output-digests", Serialize(data.output_digests, alloc), alloc);
+    }
+    if (!data.manifest.empty()) {
+        value.AddMember("manifest", Serialize(data.manifest, alloc), alloc);
+    }
     return value;
 }
 
 template <>
 inline void Deserialize<RunResponse>(RunResponse &data, const rapidjson::Value &value) {
+    Deserialize(data.task_id, value["task-id"]);
     if (value.HasMember("error")) {
         Deserialize(data.error, value["error"]);
     }
     if (value.HasMember("status")) {
         Deserialize(data.status, value["status"]);
     }
+    if (value.HasMember("output-digests")) {
+        Deserialize(data.output_digests, value["output-digests"]);
+    }
+    if (value.HasMember("manifest")) {
+        Deserialize(data.manifest, value["manifest"]);
+    }
+}
+
+template <>
+inline void Write<RunResponse>(const RunResponse &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("task-id");
+    Write(data.task_id, writer);
+    if (data.error.has_value()) {
+        writer.Key("error");
+        Write(data.error, writer);
+    }
+    if (data.status.has_value()) {
+        writer.Key("status");
+        Write(data.status, writer);
+    }
+    if (!data.output_digests.empty()) {
+        writer.Key("output-digests");
+        Write(data.output_digests, writer);
+    }
+    if (!data.manifest.empty()) {
+        writer.Key("manifest");
+        Write(data.manifest, writer);
+    }
+    writer.EndObject();
+}
+
+template <>
+inline void Read<RunResponse>(RunResponse &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "task-id") {
+            Read(data.task_id, reader);
+        } else if (key == "error") {
+            Read(data.error, reader);
+        } else if (key == "status") {
+            Read(data.status, reader);
+        } else if (key == "output-digests") {
+            Read(data.output_digests, reader);
+        } else if (key == "manifest") {
+            Read(data.manifest, reader);
+        } else {
+            reader.Skip();
+        }
+    }
+}
+
+template <>
+inline void Encode<RunResponse>(const RunResponse &data, std::string &out) {
+    Encode(data.task_id, out);
+    Encode(data.error, out);
+    Encode(data.status, out);
+    Encode(data.output_digests, out);
+    Encode(data.manifest, out);
+}
+
+template <>
+inline void Decode<RunResponse>(RunResponse &data, WireReader &reader) {
+    Decode(data.task_id, reader);
+    Decode(data.error, reader);
+    Decode(data.status, reader);
+    Decode(data.output_digests, reader);
+    Decode(data.manifest, reader);
 }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <string_view>
 
+#include "json_reader.h"
 #include "serialize.h"
+#include "wire.h"
 
 struct RunStatus {
     bool exited, signaled, time_limit_exceeded, wall_time_limit_exceeded, memory_limit_exceeded,
@@ -49,3 +53,106 @@ inline void Deserialize<RunStatus>(RunStatus &data, const rapidjson::Value &valu
     Deserialize(data.wall_time_usage_ms, value["wall-time-usage-ms"]);
     Deserialize(data.memory_usage_kb, value["memory-usage-kb"]);
 }
+
+template <>
+inline void Write<RunStatus>(const RunStatus &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("exited");
+    Write(data.exited, writer);
+    writer.Key("signaled");
+    Write(data.signaled, writer);
+    writer.Key("time-limit-exceeded");
+    Write(data.time_limit_exceeded, writer);
+    writer.Key("wall-time-limit-exceeded");
+    Write(data.wall_time_limit_exceeded, writer);
+    writer.Key("memory-limit-exceeded");
+    Write(data.memory_limit_exceeded, writer);
+    writer.Key("oom-killed");
+    Write(data.oom_killed, writer);
+    writer.Key("exit-code");
+    Write(data.exit_code, writer);
+    writer.Key("term-signal");
+    Write(data.term_signal, writer);
+    writer.Key("time-usage-ms");
+    Write(data.time_usage_ms, writer);
+    writer.Key("time-usage-sys-ms");
+    Write(data.time_usage_sys_ms, writer);
+    writer.Key("time-usage-user-ms");
+    Write(data.time_usage_user_ms, writer);
+    writer.Key("wall-time-usage-ms");
+    Write(data.wall_time_usage_ms, writer);
+    writer.Key("memory-usage-kb");
+    Write(data.memory_usage_kb, writer);
+    writer.EndObject();
+}
+
+template <>
+inline void Read<RunStatus>(RunStatus &data, JSONReader &reader) {
+    reader.Expect(JSONReader::Token::kStartObject);
+    while (reader.NextKey()) {
+        std::string_view key = reader.GetString();
+        if (key == "exited") {
+            Read(data.exited, reader);
+        } else if (key == "signaled") {
+            Read(data.signaled, reader);
+        } else if (key == "time-limit-exceeded") {
+            Read(data.time_limit_exceeded, reader);
+        } else if (key == "wall-time-limit-exceeded") {
+            Read(data.wall_time_limit_exceeded, reader);
+        } else if (key == "memory-limit-exceeded") {
+            Read(data.memory_limit_exceeded, reader);
+        } else if (key == "oom-killed") {
+            Read(data.oom_killed, reader);
+        } else if (key == "exit-code") {
+            Read(data.exit_code, reader);
+        } else if (key == "term-signal") {
+            Read(data.term_signal, reader);
+        } else if (key == "time-usage-ms") {
+            Read(data.time_usage_ms, reader);
+        } else if (key == "time-usage-sys-ms") {
+            Read(data.time_usage_sys_ms, reader);
+        } else if (key == "time-usage-user-ms") {
+            Read(data.time_usage_user_ms, reader);
+        } else if (key == "wall-time-usage-ms") {
+            Read(data.wall_time_usage_ms, reader);
+        } else if (key == "memory-usage-kb") {
+            Read(data.memory_usage_kb, reader);
+        } else {
+            reader.Skip();
+        }
+    }
+}
+
+template <>
+inline void Encode<RunStatus>(const RunStatus &data, std::string &out) {
+    Encode(data.exited, out);
+    Encode(data.signaled, out);
+    Encode(data.time_limit_exceeded, out);
+    Encode(data.wall_time_limit_exceeded, out);
+    Encode(data.memory_limit_exceeded, out);
+    Encode(data.oom_killed, out);
+    Encode(data.exit_code, out);
+    Encode(data.term_signal, out);
+    Encode(data.time_usage_ms, out);
+    Encode(data.time_usage_sys_ms, out);
+    Encode(data.time_usage_user_ms, out);
+    Encode(data.wall_time_usage_ms, out);
+    Encode(data.memory_usage_kb, out);
+}
+
+template <>
+inline void Decode<RunStatus>(RunStatus &data, WireReader &reader) {
+    Decode(data.exited, reader);
+    Decode(data.signaled, reader);
+    Decode(data.time_limit_exceeded, reader);
+    Decode(data.wall_time_limit_exceeded, reader);
+    Decode(data.memory_limit_exceeded, reader);
+    Decode(data.oom_killed, reader);
+    Decode(data.exit_code, reader);
+    Decode(data.term_signal, reader);
+    Decode(data.time_usage_ms, reader);
+    Decode(data.time_usage_sys_ms, reader);
+    Decode(data.time_usage_user_ms, reader);
+    Decode(data.wall_time_usage_ms, reader);
+    Decode(data.memory_usage_kb, reader);
+}
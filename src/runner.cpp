@@ -1,12 +1,39 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <cstdlib>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <libsbox.h>
 
 #include "config.h"
+#include "definitions.h"
+#include "digest.h"
+#include "error.h"
 #include "json.h"
 #include "logger.h"
 #include "net.h"
@@ -14,6 +41,7 @@
 #include "run_request.h"
 #include "run_response.h"
 #include "run_status.h"
+#include "wire.h"
 
 namespace fs = std::filesystem;
 
@@ -63,22 +91,458 @@ void FillStatus(const libsbox::Task &task, RunStatus &status) {
     status.memory_usage_kb = task.get_memory_usage_kb();
 }
 
+void FillOutputs(const RunRequest &request, RunResponse &response) {
+    // The scheduler resolves connections from the manifest alone, so every output is looked at
+    // here, next to the container, and never on the scheduler side.
+    auto container_bind = std::find_if(request.binds.begin(), request.binds.end(),
+                                       [](const Bind &bind) { return bind.inside == "."; });
+    if (container_bind == request.binds.end()) {
+        return;
+    }
+    for (const auto &output : request.outputs) {
+        fs::path output_path = fs::path(container_bind->outside) / output;
+        try {
+            auto output_status = fs::status(output_path);
+            if (!fs::exists(output_status)) {
+                response.output_digests.emplace_back();
+                continue;
+            }
+            // A streaming output is a FIFO that has been drained by its consumer, so it has no
+            // contents to digest.
+            auto mtime = fs::last_write_time(output_path).time_since_epoch();
+            std::string digest = fs::is_fifo(output_status) ? "" : DigestPath(output_path);
+            response.manifest.push_back(
+                {.path = output,
+                 .size = fs::is_regular_file(output_status)
+                             ? static_cast<int64_t>(fs::file_size(output_path))
+                             : 0,
+                 .mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime).count()});
+            response.output_digests.push_back(std::move(digest));
+        } catch (const fs::filesystem_error &) {
+            response.output_digests.emplace_back();
+        }
+    }
+}
+
 RunResponse ProcessRequest(const RunRequest &request) {
     libsbox::Task task;
     FillTask(request, task);
     auto error = libsbox::run_together({&task});
-    RunResponse response;
+    RunResponse response = {.task_id = request.task_id};
     if (error) {
         response.error = error.get();
     } else {
         response.status.emplace();
         FillStatus(task, response.status.value());
+        FillOutputs(request, response);
+    }
+    return response;
+}
+
+struct RunningTask {
+    pid_t pid = 0;
+    std::string container_path;
+    bool cancelled = false;
+};
+
+const int kCancelIntervalMs = 100;
+
+std::string ReadAll(int fd) {
+    std::string text;
+    char buffer[4096];
+    ssize_t cnt_read;
+    while ((cnt_read = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (cnt_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        text.append(buffer, cnt_read);
+    }
+    return text;
+}
+
+bool WriteAll(int fd, std::string_view text) {
+    while (!text.empty()) {
+        ssize_t written = write(fd, text.data(), text.size());
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        text.remove_prefix(written);
+    }
+    return true;
+}
+
+void RunnerTask() {
+    RunRequest request;
+    try {
+        DecodeMessage(request, ReadAll(STDIN_FILENO));
+    } catch (const ParseError &) {
+        exit(EXIT_FAILURE);
+    }
+    if (!WriteAll(STDOUT_FILENO, EncodeMessage(ProcessRequest(request)))) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int SpawnTask(int stdin_fd, int stdout_fd, pid_t &pid) {
+    // The helper leads its own process group, and starts with the default mask and dispositions
+    // of the signals the runner blocks or ignores.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    char arg0[] = "polygraph", arg1[] = "runner", arg2[] = "task";
+    char *argv[] = {arg0, arg1, arg2, nullptr};
+    int error = posix_spawn(&pid, "/proc/self/exe", &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return error;
+}
+
+bool IsSameFile(const std::string &path, const struct stat &file_stat) {
+    struct stat path_stat;
+    return stat(path.c_str(), &path_stat) == 0 && path_stat.st_dev == file_stat.st_dev &&
+           path_stat.st_ino == file_stat.st_ino;
+}
+
+void KillContainerProcesses(const std::string &container_path) {
+    // The sandboxed processes are children of libsboxd, not of the runner, and libsbox offers
+    // no way to stop them. They are found by their root or working directory being the
+    // container, and killed together with all their descendants.
+    struct stat container_stat;
+    if (stat(container_path.c_str(), &container_stat) != 0) {
+        return;
+    }
+    std::unordered_map<pid_t, std::vector<pid_t>> children;
+    std::vector<pid_t> victims;
+    std::error_code error;
+    for (const auto &entry : fs::directory_iterator("/proc", error)) {
+        std::string name = entry.path().filename().string();
+        pid_t pid;
+        if (std::from_chars(name.data(), name.data() + name.size(), pid).ptr !=
+            name.data() + name.size()) {
+            continue;
+        }
+        std::string proc_path = entry.path().string();
+        if (IsSameFile(proc_path + "/root", container_stat) ||
+            IsSameFile(proc_path + "/cwd", container_stat)) {
+            victims.push_back(pid);
+        }
+        // The parent comes after the state, which follows the parenthesized command name.
+        std::ifstream stat_file(proc_path + "/stat");
+        std::string stat_text((std::istreambuf_iterator<char>(stat_file)),
+                              std::istreambuf_iterator<char>());
+        size_t position = stat_text.rfind(')');
+        pid_t parent_pid;
+        if (position != std::string::npos && position + 4 < stat_text.size() &&
+            std::from_chars(stat_text.data() + position + 4,
+                            stat_text.data() + stat_text.size(), parent_pid)
+                    .ec == std::errc()) {
+            children[parent_pid].push_back(pid);
+        }
+    }
+    for (size_t i = 0; i < victims.size(); ++i) {
+        auto iter = children.find(victims[i]);
+        if (iter != children.end()) {
+            victims.insert(victims.end(), iter->second.begin(), iter->second.end());
+            children.erase(iter);
+        }
+    }
+    for (pid_t pid : victims) {
+        kill(pid, SIGKILL);
+    }
+}
+
+void KillTask(const RunningTask &task) {
+    if (!task.container_path.empty()) {
+        KillContainerProcesses(task.container_path);
+    } else if (task.pid > 0) {
+        // Without a container the sandboxed processes cannot be told apart, so only the helper
+        // is killed, which leaves libsboxd to notice that its client is gone.
+        kill(-task.pid, SIGKILL);
+    }
+}
+
+std::string ReadTaskResult(int fd, size_t task_id, std::mutex &tasks_mutex,
+                           std::unordered_map<size_t, RunningTask> &tasks) {
+    // Once the task is cancelled, its processes are killed again every kCancelIntervalMs until
+    // the helper is done, in case libsbox had not started them yet the time before.
+    std::string text;
+    char buffer[4096];
+    pollfd poll_fd = {.fd = fd, .events = POLLIN};
+    while (true) {
+        int cnt_ready = poll(&poll_fd, 1, kCancelIntervalMs);
+        if (cnt_ready < 0 && errno != EINTR) {
+            return text;
+        }
+        if (cnt_ready > 0) {
+            ssize_t cnt_read = read(fd, buffer, sizeof(buffer));
+            if (cnt_read == 0 || (cnt_read < 0 && errno != EINTR)) {
+                return text;
+            }
+            if (cnt_read > 0) {
+                text.append(buffer, cnt_read);
+            }
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        const auto &task = tasks[task_id];
+        if (task.cancelled) {
+            KillTask(task);
+        }
+    }
+}
+
+RunResponse ProcessCancellableRequest(const RunRequest &request, std::mutex &tasks_mutex,
+                                      std::unordered_map<size_t, RunningTask> &tasks) {
+    // libsbox blocks until the task is over, so the request is processed by a helper process
+    // leading its own process group, while the runner waits for its result and kills the
+    // sandboxed processes on cancellation. The slot of the task is only given back once they
+    // are gone and libsbox has returned. The helper is a new image of the runner rather than a
+    // fork, since a forked copy of this multi-threaded process could deadlock on a lock held by
+    // another thread. The pipes are close-on-exec, so the helper inherits none of the
+    // descriptors of the runner but its stdin and stdout.
+    RunResponse response = {.task_id = request.task_id};
+    int request_fds[2], result_fds[2];
+    pid_t pid;
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        if (tasks[request.task_id].cancelled) {
+            tasks.erase(request.task_id);
+            response.error = CANCELLED_ERROR;
+            return response;
+        }
+        if (pipe2(request_fds, O_CLOEXEC) != 0) {
+            tasks.erase(request.task_id);
+            response.error = strerror(errno);
+            return response;
+        }
+        if (pipe2(result_fds, O_CLOEXEC) != 0) {
+            response.error = strerror(errno);
+            close(request_fds[0]);
+            close(request_fds[1]);
+            tasks.erase(request.task_id);
+            return response;
+        }
+        int error = SpawnTask(request_fds[0], result_fds[1], pid);
+        close(request_fds[0]);
+        close(result_fds[1]);
+        if (error != 0) {
+            close(request_fds[1]);
+            close(result_fds[0]);
+            tasks.erase(request.task_id);
+            response.error = strerror(error);
+            return response;
+        }
+        tasks[request.task_id].pid = pid;
+        for (const auto &bind : request.binds) {
+            if (bind.inside == ".") {
+                tasks[request.task_id].container_path = bind.outside;
+            }
+        }
+    }
+    // A helper that dies before reading the request leaves no result, which is reported below.
+    WriteAll(request_fds[1], EncodeMessage(request));
+    close(request_fds[1]);
+    std::string text = ReadTaskResult(result_fds[0], request.task_id, tasks_mutex, tasks);
+    close(result_fds[0]);
+    int wstatus = 0;
+    waitpid(pid, &wstatus, 0);
+    bool cancelled;
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        cancelled = tasks[request.task_id].cancelled;
+        tasks.erase(request.task_id);
+    }
+    if (cancelled) {
+        response.error = CANCELLED_ERROR;
+    } else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS && !text.empty()) {
+        try {
+            DecodeMessage(response, text);
+        } catch (const ParseError &) {
+            // The helper died halfway through writing its result.
+            response = {.task_id = request.task_id, .error = TASK_TERMINATED_ERROR};
+        }
+    } else {
+        response.error = TASK_TERMINATED_ERROR;
     }
     return response;
 }
 
-Runner::Runner(const std::string &id, const std::string &partition)
-    : id_(id), partition_(partition) {
+void CancelRequest(size_t task_id, std::mutex &tasks_mutex,
+                   std::unordered_map<size_t, RunningTask> &tasks) {
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    auto iter = tasks.find(task_id);
+    if (iter == tasks.end()) {
+        return;
+    }
+    iter->second.cancelled = true;
+    KillTask(iter->second);
+}
+
+void CancelAllRequests(std::mutex &tasks_mutex, std::unordered_map<size_t, RunningTask> &tasks) {
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    for (auto &[task_id, task] : tasks) {
+        task.cancelled = true;
+        KillTask(task);
+    }
+}
+
+bool UsesStreams(const RunRequest &request) {
+    std::error_code error;
+    for (const auto &bind : request.binds) {
+        if (fs::is_fifo(bind.outside, error)) {
+            return true;
+        }
+        if (bind.inside == ".") {
+            for (const auto &output : request.outputs) {
+                if (fs::is_fifo(fs::path(bind.outside) / output, error)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Percent-encodes everything but unreserved characters, which the scheduler decodes back when it
+// reads the query.
+std::string EncodeQueryValue(std::string_view value) {
+    static const char kHexDigits[] = "0123456789ABCDEF";
+    std::string result;
+    for (unsigned char c : value) {
+        if (std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            result += static_cast<char>(c);
+        } else {
+            result += '%';
+            result += kHexDigits[c >> 4];
+            result += kHexDigits[c & 15];
+        }
+    }
+    return result;
+}
+
+// One worker per cpu advertised to the scheduler, processing requests in the order they arrive.
+// The scheduler places the peers of a stream on one node even past its capacity, and a peer
+// waiting in the queue would block the one already running on the open of the FIFO, so such
+// requests are urgent: they go ahead of the others, and when no worker is free to take one, an
+// extra worker is started for it. Extra workers exit as soon as no urgent request is left and are
+// joined on the next submit.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t cnt_workers) {
+        for (size_t i = 0; i < cnt_workers; ++i) {
+            workers_.emplace_back([this] { Work(false); });
+        }
+    }
+
+    void Submit(std::function<void()> job, bool urgent) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto id : finished_) {
+            auto it = extra_workers_.find(id);
+            it->second.join();
+            extra_workers_.erase(it);
+        }
+        finished_.clear();
+        if (!urgent) {
+            jobs_.push_back(std::move(job));
+            cv_.notify_one();
+            return;
+        }
+        urgent_jobs_.push_back(std::move(job));
+        if (cnt_idle_ >= urgent_jobs_.size()) {
+            cv_.notify_one();
+            return;
+        }
+        std::thread worker([this] { Work(true); });
+        auto id = worker.get_id();
+        extra_workers_.emplace(id, std::move(worker));
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            jobs_.clear();
+            urgent_jobs_.clear();
+        }
+        cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+        for (auto &[id, worker] : extra_workers_) {
+            worker.join();
+        }
+        extra_workers_.clear();
+        finished_.clear();
+    }
+
+    ~WorkerPool() {
+        if (!stopped_) {
+            Stop();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_, urgent_jobs_;
+    std::vector<std::thread> workers_;
+    std::unordered_map<std::thread::id, std::thread> extra_workers_;
+    std::vector<std::thread::id> finished_;
+    size_t cnt_idle_ = 0;
+    bool stopped_ = false;
+
+    void Work(bool extra) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (extra && urgent_jobs_.empty() && !stopped_) {
+                finished_.push_back(std::this_thread::get_id());
+                return;
+            }
+            ++cnt_idle_;
+            cv_.wait(lock, [this] { return stopped_ || !jobs_.empty() || !urgent_jobs_.empty(); });
+            --cnt_idle_;
+            if (stopped_) {
+                return;
+            }
+            auto &queue = urgent_jobs_.empty() ? jobs_ : urgent_jobs_;
+            auto job = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+};
+
+Runner::Runner(const std::string &id, const std::string &partition, const std::string &node,
+               const Resources &capacity)
+    : id_(id), partition_(partition), node_(node), capacity_(capacity) {
+    if (capacity_.cpus <= 0) {
+        capacity_.cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    if (node_.empty()) {
+        char hostname[HOST_NAME_MAX + 1] = {};
+        gethostname(hostname, sizeof(hostname) - 1);
+        node_ = hostname;
+    }
 }
 
 void RunnerInterruptHandler(int signum) {
@@ -89,33 +553,92 @@ void RunnerInterruptHandler(int signum) {
 void Runner::Run() {
     std::string name = std::string("runner ") + id_;
     Logger::Get().SetName(name);
+    Logger::Get().SetLevel(Config::Get().log_level);
+    Logger::Get().Start();
     signal(SIGINT, RunnerInterruptHandler);
     signal(SIGTERM, RunnerInterruptHandler);
+    // A helper that dies before reading its request turns the write into an error, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+    std::string target =
+        "/runner/" + partition_ + "/" + id_ + "?cpus=" + std::to_string(capacity_.cpus);
+    if (capacity_.memory_kb > 0) {
+        target += "&memory-kb=" + std::to_string(capacity_.memory_kb);
+    }
+    if (capacity_.threads > 0) {
+        target += "&threads=" + std::to_string(capacity_.threads);
+    }
+    target += "&node=" + EncodeQueryValue(node_);
+    if (Config::Get().runner_wire_version > 0) {
+        target += "&wire-version=" + std::to_string(Config::Get().runner_wire_version);
+    }
     bool connected = true;
     while (true) {
+        WebsocketClientSession session;
+        std::mutex tasks_mutex;
+        std::unordered_map<size_t, RunningTask> tasks;
+        WorkerPool pool(capacity_.cpus);
         try {
-            WebsocketClientSession session;
-            session.Connect(Config::Get().host, Config::Get().port,
-                            "/runner/" + partition_ + "/" + id_);
+            session.Connect(Config::Get().host, Config::Get().port, target);
             connected = true;
             Log("Connected to ", Config::Get().host, ":", Config::Get().port);
             session.OnRead([&](const std::string &message) {
-                std::thread([=, &session] {
-                    RunRequest request;
-                    Deserialize(request, ParseJSON(message));
-                    RunResponse response = ProcessRequest(request);
-                    session.Write(StringifyJSON(Serialize(response)));
-                }).detach();
+                if (message.starts_with(CANCEL_SIGNAL)) {
+                    const char *begin = message.data() + strlen(CANCEL_SIGNAL) + 1;
+                    const char *end = message.data() + message.size();
+                    size_t task_id;
+                    auto result = std::from_chars(std::min(begin, end), end, task_id);
+                    if (result.ec != std::errc() || result.ptr != end) {
+                        LogWarning("Dropped malformed cancel signal '", message, "'");
+                        return;
+                    }
+                    Log("Cancelling task ", task_id);
+                    CancelRequest(task_id, tasks_mutex, tasks);
+                    return;
+                }
+                // Responses go back in the encoding the scheduler chose for the request.
+                RunRequest request;
+                bool binary = IsWireMessage(message);
+                int wire_version = 0;
+                try {
+                    if (binary) {
+                        wire_version = DecodeMessage(request, message);
+                    } else {
+                        FromJSON(request, message);
+                    }
+                } catch (const ParseError &error) {
+                    LogWarning("Dropped request, ", error.message);
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(tasks_mutex);
+                    tasks[request.task_id];
+                }
+                bool urgent = UsesStreams(request);
+                pool.Submit(
+                    [request = std::move(request), binary, wire_version, &session, &tasks_mutex,
+                     &tasks] {
+                        RunResponse response =
+                            ProcessCancellableRequest(request, tasks_mutex, tasks);
+                        if (binary) {
+                            session.Send(EncodeMessage(response, wire_version), true);
+                        } else {
+                            session.Send(std::string(ToJSON(response)));
+                        }
+                    },
+                    urgent);
             });
             session.Run();
         } catch (const beast::system_error &error) {
             if (connected) {
                 connected = false;
-                Log("Not connected to ", Config::Get().host, ":", Config::Get().port, ": ",
-                    error.what());
+                LogWarning("Not connected to ", Config::Get().host, ":", Config::Get().port, ": ",
+                           error.what());
             }
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(Config::Get().runner_reconnect_interval_ms));
         }
+        // The scheduler gives up on the tasks of a lost runner and retries them elsewhere.
+        CancelAllRequests(tasks_mutex, tasks);
+        pool.Stop();
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(Config::Get().runner_reconnect_interval_ms));
     }
 }
@@ -2,12 +2,20 @@
 
 #include <string>
 
+#include "resources.h"
+
 class Runner {
 public:
-    Runner(const std::string &id, const std::string &partition);
+    Runner(const std::string &id, const std::string &partition, const std::string &node,
+           const Resources &capacity);
 
     void Run();
 
 private:
-    std::string id_, partition_;
+    std::string id_, partition_, node_;
+    Resources capacity_;
 };
+
+// Processes one request read from stdin and writes the response to stdout, both in the binary
+// encoding. This is the helper the runner spawns for each request.
+void RunnerTask();
@@ -31,7 +31,10 @@ void RunnerStart(const RunnerStartOptions &options) {
         if (child_pid == 0) {
             Daemonize();
             pid_file << getpid() << std::endl;
-            auto runner = Runner(std::to_string(runner_id), options.partition);
+            auto runner = Runner(std::to_string(runner_id), options.partition, options.node,
+                                 {.cpus = options.cpus,
+                                  .memory_kb = options.memory_kb,
+                                  .threads = options.threads});
             runner.Run();
         }
     }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <string>
@@ -11,7 +12,8 @@ class RunnerStartOptions {
 public:
     po::options_description desc{"Options"};
     int num;
-    std::string partition;
+    std::string partition, node;
+    int64_t cpus, memory_kb, threads;
 
     void HelpMessage() const {
         std::cerr << "Connect new runners to polygraph." << std::endl;
@@ -28,6 +30,14 @@ public:
                            "number of runners to start");
         desc.add_options()("partition", po::value<std::string>(&partition)->default_value("all"),
                            "partition to subscribe runners to");
+        desc.add_options()("node", po::value<std::string>(&node)->default_value(""),
+                           "node the runners report to the scheduler (hostname by default)");
+        desc.add_options()("cpus", po::value<int64_t>(&cpus)->default_value(1),
+                           "number of blocks a runner executes at once (0 for all cores)");
+        desc.add_options()("memory-kb", po::value<int64_t>(&memory_kb)->default_value(0),
+                           "total memory limit of blocks on a runner (0 for no limit)");
+        desc.add_options()("threads", po::value<int64_t>(&threads)->default_value(0),
+                           "total thread limit of blocks on a runner (0 for no limit)");
         po::variables_map vm;
         try {
             po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
@@ -1,23 +1,81 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <system_error>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
 
 #include "block_response.h"
+#include "client_snapshot.h"
+#include "config.h"
 #include "definitions.h"
+#include "digest.h"
 #include "error.h"
 #include "json.h"
 #include "logger.h"
+#include "result_cache.h"
 #include "run_request.h"
 #include "run_response.h"
 #include "scheduler.h"
 #include "uuid.h"
+#include "wire.h"
 
 namespace fs = std::filesystem;
 
-void WorkflowState::Init(const rapidjson::Document &document) {
-    Deserialize(static_cast<Workflow &>(*this), document);
-    blocks_state_.resize(blocks.size());
-    go_.resize(blocks.size());
+void WorkflowState::Init(const rapidjson::Value &document, size_t definition_size) {
+    Workflow workflow;
+    Deserialize(workflow, document);
+    auto graph = BuildGraph(workflow);
+    Init(std::move(workflow), std::move(graph), definition_size);
+}
+
+void WorkflowState::Init(Workflow workflow, std::shared_ptr<const WorkflowGraph> graph,
+                         size_t definition_size) {
+    static_cast<Workflow &>(*this) = std::move(workflow);
+    graph_ = std::move(graph);
+    blocks_state_.assign(blocks.size(), {});
+    cnt_ready_.assign(blocks.size(), 0);
+    lower_wall_times_ms_.clear();
+    upper_wall_times_ms_.clear();
+    for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
+        blocks_state_[block_id].output_digests.resize(blocks[block_id].outputs.size());
+        blocks_state_[block_id].output_files.resize(blocks[block_id].outputs.size());
+    }
+    UpdatePriorities();
+    // Rough footprint of the workflow: its definition plus the per-block and per-edge state.
+    memory_usage_ = definition_size + blocks.size() * sizeof(BlockState) +
+                    connections.size() * sizeof(Connection);
+    run_request_parts_.resize(blocks.size());
+    wire_run_request_parts_.resize(blocks.size());
+    for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
+        run_request_parts_[block_id] = BuildRunRequestParts(block_id);
+        wire_run_request_parts_[block_id] = BuildWireRunRequestParts(block_id);
+        for (const auto &part : run_request_parts_[block_id]) {
+            memory_usage_ += part.size();
+        }
+        for (const auto &part : wire_run_request_parts_[block_id]) {
+            memory_usage_ += part.size();
+        }
+    }
+}
+
+std::shared_ptr<const WorkflowGraph> WorkflowState::BuildGraph(const Workflow &workflow) {
+    const auto &blocks = workflow.blocks;
+    auto graph = std::make_shared<WorkflowGraph>();
+    graph->go.resize(blocks.size());
     for (const auto &block : blocks) {
         std::unordered_set<std::string> paths;
         for (const auto &input : block.inputs) {
@@ -33,15 +91,80 @@ void WorkflowState::Init(const rapidjson::Document &document) {
             throw ValidationError(DUPLICATED_PATH_ERROR);
         }
     }
-    for (const auto &connection : connections) {
+    for (const auto &connection : workflow.connections) {
         if (connection.source_block_id >= blocks.size() ||
             connection.source_output_id >= blocks[connection.source_block_id].outputs.size() ||
             connection.target_block_id >= blocks.size() ||
             connection.target_input_id >= blocks[connection.target_block_id].inputs.size()) {
             throw ValidationError(INVALID_CONNECTION_ERROR);
         }
-        go_[connection.source_block_id].push_back(connection);
+        graph->go[connection.source_block_id].push_back(connection);
+    }
+    // A stream is a FIFO with a single reader, so a streaming output feeds exactly one input. A
+    // block reads at most one stream, since it has to run on the node of the producer.
+    graph->stream_source.assign(blocks.size(), std::nullopt);
+    graph->stream_peers.assign(blocks.size(), {});
+    for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
+        const auto &outputs = blocks[block_id].outputs;
+        std::vector<size_t> cnt_readers(outputs.size());
+        for (const auto &connection : graph->go[block_id]) {
+            if (!outputs[connection.source_output_id].streaming) {
+                continue;
+            }
+            size_t target_block_id = connection.target_block_id;
+            if (target_block_id == block_id ||
+                graph->stream_source[target_block_id].has_value() ||
+                blocks[target_block_id].inputs[connection.target_input_id].cached) {
+                throw ValidationError(INVALID_STREAM_ERROR);
+            }
+            ++cnt_readers[connection.source_output_id];
+            graph->stream_source[target_block_id] = block_id;
+            graph->stream_peers[block_id].push_back(target_block_id);
+            graph->stream_peers[target_block_id].push_back(block_id);
+        }
+        for (size_t output_id = 0; output_id < outputs.size(); ++output_id) {
+            if (outputs[output_id].streaming && cnt_readers[output_id] != 1) {
+                throw ValidationError(INVALID_STREAM_ERROR);
+            }
+        }
+    }
+    FindComponents(*graph);
+    graph->upstream.assign(graph->components.size(), {});
+    for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
+        for (const auto &connection : graph->go[block_id]) {
+            size_t source_component_id = graph->component[block_id];
+            size_t target_component_id = graph->component[connection.target_block_id];
+            if (source_component_id != target_component_id) {
+                graph->upstream[target_component_id].push_back(source_component_id);
+            }
+        }
+    }
+    for (auto &sources : graph->upstream) {
+        std::sort(sources.begin(), sources.end());
+        sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+    }
+    return graph;
+}
+
+bool WorkflowState::IsRunning() const {
+    return is_running_;
+}
+
+size_t WorkflowState::GetMemoryUsage() const {
+    return memory_usage_;
+}
+
+ArchivedWorkflow WorkflowState::Archive() const {
+    ArchivedWorkflow archived = {.workflow_id = workflow_id,
+                                 .partition = meta.partition,
+                                 .cnt_workflow_runs = cnt_workflow_runs_,
+                                 .blocks = {}};
+    for (const auto &block_state : blocks_state_) {
+        if (block_state.last_response.has_value()) {
+            archived.blocks.push_back(block_state.last_response.value());
+        }
     }
+    return archived;
 }
 
 void WorkflowState::Run() {
@@ -49,9 +172,15 @@ void WorkflowState::Run() {
         throw RuntimeError(ALREADY_RUNNING_ERROR);
     }
     is_running_ = true;
+    ++cnt_workflow_runs_;
+    AppendEvent({.type = RUN_EVENT, .workflow_id = workflow_id});
     for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
         blocks_state_[block_id].cnt_inputs_ready = 0;
+        blocks_state_[block_id].stream_cancelled = false;
         blocks_state_[block_id].input_sources.assign(blocks[block_id].inputs.size(), {});
+        blocks_state_[block_id].input_nodes.assign(blocks[block_id].inputs.size(), "");
+        blocks_state_[block_id].input_sizes.assign(blocks[block_id].inputs.size(), 0);
+        blocks_state_[block_id].input_digests.assign(blocks[block_id].inputs.size(), {});
         if (IsBlockReady(block_id)) {
             EnqueueBlock(block_id);
         }
@@ -60,86 +189,466 @@ void WorkflowState::Run() {
 }
 
 void WorkflowState::Stop() {
-    // TODO
-    throw RuntimeError(NOT_IMPLEMENTED_ERROR);
+    if (!is_running_) {
+        throw RuntimeError(NOT_RUNNING_ERROR);
+    }
+    if (is_stopping_) {
+        return;
+    }
+    is_stopping_ = true;
+    AppendEvent({.type = STOP_EVENT, .workflow_id = workflow_id});
+    // Blocks that have not reached a runner yet are dropped, the others finish on cancellation.
+    blocks_ready_ = {};
+    cnt_ready_.assign(blocks.size(), 0);
+    std::erase_if(blocks_processing_,
+                  [this](size_t block_id) { return !blocks_state_[block_id].dispatched; });
+    if (!replaying_) {
+        partition_ptr->CancelWorkflow(this);
+    }
+    Log("Workflow ", workflow_id, ": stopping");
+    UpdateBlocksProcessing();
+}
+
+WorkflowSnapshot WorkflowState::Save() const {
+    WorkflowSnapshot snapshot = {.workflow_id = workflow_id,
+                                 .workflow = static_cast<const Workflow &>(*this),
+                                 .is_running = is_running_,
+                                 .is_stopping = is_stopping_,
+                                 .cnt_workflow_runs = cnt_workflow_runs_,
+                                 .blocks_state = blocks_state_,
+                                 .blocks_ready = {},
+                                 .blocks_processing = {blocks_processing_.begin(),
+                                                       blocks_processing_.end()}};
+    auto blocks_ready = blocks_ready_;
+    while (!blocks_ready.empty()) {
+        snapshot.blocks_ready.push_back(blocks_ready.top().block_id);
+        blocks_ready.pop();
+    }
+    return snapshot;
+}
+
+void WorkflowState::Load(const WorkflowSnapshot &snapshot) {
+    // The definition as submitted is gone after a restart, its serialized form stands in for it.
+    auto document = Serialize(snapshot.workflow);
+    Init(document, StringifyJSON(document).size());
+    replaying_ = true;
+    workflow_id = snapshot.workflow_id;
+    is_running_ = snapshot.is_running;
+    is_stopping_ = snapshot.is_stopping;
+    cnt_workflow_runs_ = snapshot.cnt_workflow_runs;
+    blocks_state_ = snapshot.blocks_state;
+    for (size_t block_id = 0; block_id < blocks_state_.size(); ++block_id) {
+        if (auto wall_time_ms = std::exchange(blocks_state_[block_id].wall_time_usage_ms, {})) {
+            SetWallTime(block_id, wall_time_ms.value());
+        }
+    }
+    UpdatePriorities();
+    for (size_t block_id : snapshot.blocks_ready) {
+        EnqueueBlock(block_id);
+    }
+    blocks_processing_.insert(snapshot.blocks_processing.begin(),
+                              snapshot.blocks_processing.end());
+}
+
+void WorkflowState::Replay(const JournalEvent &event) {
+    // Events are applied through the same transitions as at run time, while nothing is sent to
+    // runners or clients and nothing is journaled again until Resume.
+    replaying_ = true;
+    if (event.type == RUN_EVENT) {
+        Run();
+    } else if (event.type == STOP_EVENT) {
+        Stop();
+    } else if (event.type == DISPATCH_EVENT) {
+        auto &block_state = blocks_state_[event.block_id.value()];
+        if (block_state.last_workflow_run != cnt_workflow_runs_) {
+            block_state.cnt_dispatches = 0;
+        }
+        block_state.last_workflow_run = cnt_workflow_runs_;
+        ++block_state.cnt_dispatches;
+        block_state.container_path = event.container_path.value();
+        block_state.node = event.node.value_or("");
+        block_state.dispatched = true;
+        ConnectStreams(event.block_id.value());
+    } else if (event.type == FINISH_EVENT) {
+        if (blocks_processing_.contains(event.block_id.value())) {
+            // The container may be that of a speculative copy, which is not journaled until it
+            // wins.
+            auto &block_state = blocks_state_[event.block_id.value()];
+            block_state.container_path = event.container_path.value_or(block_state.container_path);
+            block_state.node = event.node.value_or(block_state.node);
+            OnStatus(event.block_id.value(), event.response.value());
+        } else {
+            Log("Workflow ", workflow_id, ": skipped stale result of block ",
+                event.block_id.value());
+        }
+    }
+}
+
+void WorkflowState::Resume() {
+    // Blocks that were running when the scheduler went down are started over from a clean
+    // container, or cancelled if the workflow was being stopped. A stream cannot be started over
+    // from the middle, so both ends of it are cancelled too.
+    replaying_ = false;
+    std::vector<size_t> blocks_processing(blocks_processing_.begin(), blocks_processing_.end());
+    for (size_t block_id : blocks_processing) {
+        auto &block_state = blocks_state_[block_id];
+        if (!block_state.speculative_container_path.empty()) {
+            ResolveSpeculation(block_id, false);
+        }
+        if (is_stopping_ || (block_state.dispatched && !graph_->stream_peers[block_id].empty())) {
+            OnStatus(block_id, {.error = CANCELLED_ERROR});
+            continue;
+        }
+        if (block_state.dispatched) {
+            block_state.dispatched = false;
+            std::error_code error;
+            fs::remove_all(block_state.container_path, error);
+        }
+        partition_ptr->EnqueueBlock(this, block_id);
+    }
+    UpdateBlocksProcessing();
 }
 
-void WorkflowState::RunBlock(size_t block_id, RunnerWebSocket *ws) {
-    ws->getUserData()->workflow_ptr = this;
-    ws->getUserData()->block_id = block_id;
+void WorkflowState::RunBlock(size_t block_id, size_t task_id, const RunnerState &runner) {
+    if (blocks_state_[block_id].last_workflow_run != cnt_workflow_runs_) {
+        blocks_state_[block_id].cnt_dispatches = 0;
+    }
+    blocks_state_[block_id].last_workflow_run = cnt_workflow_runs_;
+    blocks_state_[block_id].dispatched = true;
+    blocks_state_[block_id].node = runner.node;
+    if (blocks_state_[block_id].stream_cancelled) {
+        partition_ptr->OnStatus(runner.socket, {.task_id = task_id, .error = CANCELLED_ERROR});
+        return;
+    }
     try {
         PrepareRun(block_id);
-        SendRunRequest(block_id, ws);
+        AppendEvent({.type = DISPATCH_EVENT,
+                     .workflow_id = workflow_id,
+                     .block_id = block_id,
+                     .container_path = blocks_state_[block_id].container_path,
+                     .node = runner.node});
+        SendRunRequest(block_id, task_id, runner, blocks_state_[block_id].container_path);
+        ++blocks_state_[block_id].cnt_dispatches;
         BlockResponse response = {.block_id = block_id, .state = RUNNING_STATE};
-        SendToAllClients(BLOCK_SIGNAL + std::string(" ") + StringifyJSON(Serialize(response)));
-        Log("Workflow ", workflow_id, ": block ", block_id, " -> runner ",
-            ws->getUserData()->runner_id);
+        SendBlockResponse(response);
+        LogDebug("Workflow ", workflow_id, ": block ", block_id, " -> runner ", runner.runner_id);
+        ConnectStreams(block_id);
     } catch (const fs::filesystem_error &error) {
-        RunResponse response = {.error = error.what()};
-        OnStatus(ws, StringifyJSON(Serialize(response)));
+        RunResponse response = {.task_id = task_id, .error = error.what()};
+        partition_ptr->OnStatus(runner.socket, response);
     }
 }
 
-void WorkflowState::OnStatus(RunnerWebSocket *ws, std::string_view message) {
-    size_t block_id = ws->getUserData()->block_id;
-    RunResponse run_response;
-    Deserialize(run_response, ParseJSON(std::string(message)));
+bool WorkflowState::RunSpeculativeCopy(size_t block_id, size_t task_id,
+                                       const RunnerState &runner) {
+    // The copy runs in a container of its own and is not journaled, the original keeps standing
+    // for the block until one of them finishes.
+    auto &block_state = blocks_state_[block_id];
+    fs::path container_path = fs::path(CONTAINERS_DIR) /
+                              (GetContainerId(block_id, block_state.cnt_runs) + "_speculative");
+    try {
+        fs::create_directories(container_path);
+        fs::permissions(container_path, fs::perms::all, fs::perm_options::add);
+    } catch (const fs::filesystem_error &) {
+        return false;
+    }
+    block_state.speculative_container_path = container_path.string();
+    block_state.speculative_node = runner.node;
+    SendRunRequest(block_id, task_id, runner, block_state.speculative_container_path);
+    LogDebug("Workflow ", workflow_id, ": block ", block_id, " -> runner ", runner.runner_id,
+             " (speculative)");
+    return true;
+}
+
+void WorkflowState::ResolveSpeculation(size_t block_id, bool keep_copy) {
+    auto &block_state = blocks_state_[block_id];
+    std::error_code error;
+    if (keep_copy) {
+        fs::remove_all(block_state.container_path, error);
+        block_state.container_path = std::move(block_state.speculative_container_path);
+        block_state.node = std::move(block_state.speculative_node);
+    } else {
+        fs::remove_all(block_state.speculative_container_path, error);
+    }
+    block_state.speculative_container_path.clear();
+    block_state.speculative_node.clear();
+}
+
+bool WorkflowState::CanSpeculate(size_t block_id) const {
+    // Running a block twice at once is only safe when it has no side effects outside its
+    // container, and a stream cannot be read or written by two processes.
+    if (is_stopping_ || !blocks_state_[block_id].dispatched ||
+        !blocks_state_[block_id].speculative_container_path.empty() ||
+        !graph_->stream_peers[block_id].empty()) {
+        return false;
+    }
+    return std::all_of(blocks[block_id].binds.begin(), blocks[block_id].binds.end(),
+                       [](const Bind &bind) { return bind.readonly; });
+}
+
+std::optional<int64_t> WorkflowState::GetExpectedWallTimeMs(size_t block_id) const {
+    // The last wall time of the block itself, or the median over the other blocks of the
+    // workflow if it has never finished.
+    if (blocks_state_[block_id].wall_time_usage_ms.has_value()) {
+        return blocks_state_[block_id].wall_time_usage_ms;
+    }
+    if (upper_wall_times_ms_.empty()) {
+        return std::nullopt;
+    }
+    return *upper_wall_times_ms_.begin();
+}
+
+void WorkflowState::SetWallTime(size_t block_id, int64_t wall_time_ms) {
+    // The wall times of the blocks are kept split in two halves around the median, which is the
+    // least of the upper half, so that stragglers are checked against it without a scan.
+    auto &block_wall_time_ms = blocks_state_[block_id].wall_time_usage_ms;
+    if (block_wall_time_ms.has_value()) {
+        auto iter = lower_wall_times_ms_.find(block_wall_time_ms.value());
+        if (iter != lower_wall_times_ms_.end()) {
+            lower_wall_times_ms_.erase(iter);
+        } else {
+            upper_wall_times_ms_.erase(upper_wall_times_ms_.find(block_wall_time_ms.value()));
+        }
+    }
+    block_wall_time_ms = wall_time_ms;
+    if (upper_wall_times_ms_.empty() || wall_time_ms >= *upper_wall_times_ms_.begin()) {
+        upper_wall_times_ms_.insert(wall_time_ms);
+    } else {
+        lower_wall_times_ms_.insert(wall_time_ms);
+    }
+    if (upper_wall_times_ms_.size() > lower_wall_times_ms_.size() + 1) {
+        lower_wall_times_ms_.insert(upper_wall_times_ms_.extract(upper_wall_times_ms_.begin()));
+    } else if (lower_wall_times_ms_.size() > upper_wall_times_ms_.size()) {
+        upper_wall_times_ms_.insert(
+            lower_wall_times_ms_.extract(std::prev(lower_wall_times_ms_.end())));
+    }
+}
+
+void WorkflowState::OnStatus(size_t block_id, const RunResponse &run_response) {
+    FinishBlock(block_id, run_response);
+    DequeueBlock(block_id);
+    UpdateBlocksProcessing();
+}
+
+void WorkflowState::FinishBlock(size_t block_id, const RunResponse &run_response) {
+    AppendEvent({.type = FINISH_EVENT,
+                 .workflow_id = workflow_id,
+                 .block_id = block_id,
+                 .container_path = blocks_state_[block_id].container_path,
+                 .node = blocks_state_[block_id].node,
+                 .response = run_response});
+    auto &block_state = blocks_state_[block_id];
+    auto input_digests = block_state.input_digests;
     FinalizeRun(block_id);
-    if (run_response.status.has_value() && run_response.status->exited &&
-        run_response.status->exit_code == 0) {
-        for (const auto &connection : go_[block_id]) {
-            if (ProcessConnection(connection) && IsBlockReady(connection.target_block_id)) {
-                EnqueueBlock(connection.target_block_id);
+    block_state.dispatched = false;
+    block_state.stream_cancelled = false;
+    block_state.cnt_retries = 0;
+    bool succeeded = run_response.status.has_value() && run_response.status->exited &&
+                     run_response.status->exit_code == 0;
+    block_state.output_digests.assign(blocks[block_id].outputs.size(), "");
+    block_state.output_files.assign(blocks[block_id].outputs.size(), std::nullopt);
+    if (succeeded) {
+        block_state.last_status = run_response.status;
+        block_state.last_input_digests = std::move(input_digests);
+        block_state.last_binds_digest = GetBindsDigest(block_id);
+        std::copy_n(run_response.output_digests.begin(),
+                    std::min(run_response.output_digests.size(), block_state.output_digests.size()),
+                    block_state.output_digests.begin());
+        for (const auto &output_file : run_response.manifest) {
+            const auto &outputs = blocks[block_id].outputs;
+            auto iter = std::find_if(outputs.begin(), outputs.end(), [&](const Output &output) {
+                return output.path == output_file.path;
+            });
+            if (iter != outputs.end()) {
+                block_state.output_files[iter - outputs.begin()] = output_file;
             }
         }
+        if (block_state.cache_key.has_value()) {
+            ResultCache::Get().Insert(block_state.cache_key.value(),
+                                      {.container_path = block_state.container_path,
+                                       .node = block_state.node,
+                                       .status = run_response.status.value(),
+                                       .output_digests = block_state.output_digests,
+                                       .manifest = run_response.manifest});
+        }
+    } else {
+        block_state.last_status.reset();
+        CancelStreamPeers(block_id);
+    }
+    block_state.cache_key.reset();
+    if (run_response.status.has_value() && run_response.status->wall_time_usage_ms >= 0) {
+        SetWallTime(block_id, std::max<int64_t>(run_response.status->wall_time_usage_ms, 1));
+        UpdatePriorities(block_id);
+    }
+    if (!is_stopping_ && succeeded) {
+        PropagateOutputs(block_id);
     }
     BlockResponse block_response = {.block_id = block_id,
                                     .state = FINISHED_STATE,
                                     .error = run_response.error,
                                     .status = run_response.status};
-    SendToAllClients(BLOCK_SIGNAL + std::string(" ") + StringifyJSON(Serialize(block_response)));
+    block_state.last_response = block_response;
+    SendBlockResponse(block_response);
     Log("Workflow ", workflow_id, ": block ", block_id, " finished, error = '",
-        block_response.error.value_or(""),
-        "', status = ", StringifyJSON(Serialize(block_response.status)));
-    partition_ptr->AddRunner(ws);
-    DequeueBlock();
-    UpdateBlocksProcessing();
+        block_response.error.value_or(""), "'");
+    LogDebug("Workflow ", workflow_id, ": block ", block_id, " status = ",
+             [&] { return ToJSON(block_response.status); });
+}
+
+void WorkflowState::OnRunnerLost(size_t block_id) {
+    auto &block_state = blocks_state_[block_id];
+    // A block at either end of a stream is not retried, since its peer has already seen a part
+    // of the stream that cannot be produced or consumed again.
+    if (is_stopping_ || !graph_->stream_peers[block_id].empty() ||
+        block_state.cnt_retries >= Config::Get().scheduler_max_retries) {
+        OnStatus(block_id, {.error = RUNNER_LOST_ERROR});
+        return;
+    }
+    // The backoff doubles with each retry, up to a cap that keeps it far below the range of int.
+    int64_t backoff_ms = std::max(Config::Get().scheduler_retry_backoff_ms, 0);
+    int delay_ms = static_cast<int>(std::min(
+        backoff_ms << std::min<size_t>(block_state.cnt_retries, 16), kMaxRetryBackoffMs));
+    ++block_state.cnt_retries;
+    block_state.dispatched = false;
+    std::error_code error;
+    fs::remove_all(block_state.container_path, error);
+    BlockResponse response = {.block_id = block_id,
+                              .state = RETRYING_STATE,
+                              .error = RUNNER_LOST_ERROR,
+                              .retry = block_state.cnt_retries};
+    SendBlockResponse(response);
+    Log("Workflow ", workflow_id, ": block ", block_id, " lost its runner, retry ",
+        block_state.cnt_retries, " in ", delay_ms, " ms");
+    // The workflow is looked up again when the timer fires, since it may have been stopped and
+    // archived in the meantime.
+    size_t shard_id = scheduler_ptr->GetShardId(meta.partition);
+    scheduler_ptr->PostDelayed(
+        shard_id, delay_ms,
+        [scheduler_ptr = scheduler_ptr, shard_id, workflow_id = workflow_id, block_id,
+         workflow_run = cnt_workflow_runs_] {
+            WorkflowState *workflow_ptr = scheduler_ptr->FindWorkflow(shard_id, workflow_id);
+            if (workflow_ptr && workflow_run == workflow_ptr->cnt_workflow_runs_ &&
+                workflow_ptr->blocks_processing_.contains(block_id)) {
+                workflow_ptr->partition_ptr->EnqueueBlock(workflow_ptr, block_id);
+            }
+        });
 }
 
 void WorkflowState::EnqueueBlock(size_t block_id) {
-    blocks_ready_.push(block_id);
+    blocks_ready_.push({.priority = blocks_state_[block_id].priority,
+                        .order = cnt_blocks_enqueued_++,
+                        .block_id = block_id});
+    ++cnt_ready_[block_id];
 }
 
-void WorkflowState::DequeueBlock() {
-    --cnt_blocks_processing_;
+void WorkflowState::DequeueBlock(size_t block_id) {
+    blocks_processing_.erase(block_id);
 }
 
 void WorkflowState::UpdateBlocksProcessing() {
-    while (!blocks_ready_.empty() && cnt_blocks_processing_ < meta.max_runners) {
-        size_t block_id = blocks_ready_.front();
+    // Blocks with a cached result finish right here without taking a runner, and the blocks they
+    // make ready are picked up by the same loop, however long a chain of them is.
+    while (!blocks_ready_.empty() && blocks_processing_.size() < meta.max_runners) {
+        size_t block_id = blocks_ready_.top().block_id;
         blocks_ready_.pop();
-        ++cnt_blocks_processing_;
-        partition_ptr->EnqueueBlock(this, block_id);
+        --cnt_ready_[block_id];
+        if (!replaying_ && ReuseCachedResult(block_id)) {
+            continue;
+        }
+        blocks_processing_.insert(block_id);
+        if (!replaying_) {
+            partition_ptr->EnqueueBlock(this, block_id);
+        }
     }
-    if (is_running_ && cnt_blocks_processing_ == 0 && blocks_ready_.empty()) {
+    if (is_running_ && blocks_processing_.empty() && blocks_ready_.empty()) {
         is_running_ = false;
+        is_stopping_ = false;
+        UpdatePriorities();
+        FlushBlockResponses();
         SendToAllClients(WORKFLOW_SIGNAL + std::string(" ") + FINISHED_STATE);
         Log("Workflow ", workflow_id, ": run finished");
+        scheduler_ptr->TouchWorkflow(this);
+    }
+}
+
+void WorkflowState::PropagateOutputs(size_t block_id) {
+    // Early cutoff: a block that gets the same inputs and binds as in its last successful run is
+    // not executed again, its previous outputs are propagated right away instead.
+    std::vector<size_t> finished_blocks = {block_id};
+    while (!finished_blocks.empty()) {
+        size_t source_block_id = finished_blocks.back();
+        finished_blocks.pop_back();
+        for (const auto &connection : graph_->go[source_block_id]) {
+            size_t target_block_id = connection.target_block_id;
+            if (!ProcessConnection(connection) || !IsBlockReady(target_block_id)) {
+                continue;
+            }
+            if (IsBlockUpToDate(target_block_id)) {
+                SkipBlock(target_block_id);
+                finished_blocks.push_back(target_block_id);
+            } else {
+                EnqueueBlock(target_block_id);
+            }
+        }
+    }
+}
+
+void WorkflowState::SkipBlock(size_t block_id) {
+    blocks_state_[block_id].last_workflow_run = cnt_workflow_runs_;
+    blocks_state_[block_id].cnt_dispatches = 0;
+    FinalizeRun(block_id);
+    BlockResponse response = {.block_id = block_id,
+                              .state = FINISHED_STATE,
+                              .status = blocks_state_[block_id].last_status};
+    blocks_state_[block_id].last_response = response;
+    SendBlockResponse(response);
+    Log("Workflow ", workflow_id, ": block ", block_id, " is up to date");
+}
+
+bool WorkflowState::IsBlockUpToDate(size_t block_id) const {
+    // A block is checked at most once per workflow run, so that cycles still make progress.
+    // Outputs are known to exist from the manifest of the last run.
+    const auto &block_state = blocks_state_[block_id];
+    if (!block_state.last_status.has_value() || !graph_->stream_peers[block_id].empty() ||
+        block_state.last_workflow_run == cnt_workflow_runs_ ||
+        block_state.input_digests != block_state.last_input_digests) {
+        return false;
+    }
+    for (const auto &input_digest : block_state.input_digests) {
+        if (!input_digest.has_value()) {
+            return false;
+        }
     }
+    for (const auto &output_file : block_state.output_files) {
+        if (!output_file.has_value()) {
+            return false;
+        }
+    }
+    auto binds_digest = GetBindsDigest(block_id);
+    return binds_digest.has_value() && binds_digest == block_state.last_binds_digest;
 }
 
 bool WorkflowState::ProcessConnection(const Connection &connection) {
+    // Whether the output was produced is taken from the manifest reported by the runner, so
+    // that no filesystem calls are made however many connections a block has.
     const auto &[source_block_id, source_output_id, target_block_id, target_input_id] = connection;
-    fs::path source_output_path =
-        fs::path(CONTAINERS_DIR) /
-        GetContainerId(source_block_id, blocks_state_[source_block_id].cnt_runs - 1) /
-        blocks[source_block_id].outputs[source_output_id].path;
-    if (!fs::exists(source_output_path) ||
+    if (blocks[source_block_id].outputs[source_output_id].streaming ||
+        !blocks_state_[source_block_id].output_files[source_output_id].has_value() ||
         blocks_state_[target_block_id].input_sources[target_input_id]) {
         return false;
     }
+    fs::path source_output_path = fs::path(blocks_state_[source_block_id].container_path) /
+                                  blocks[source_block_id].outputs[source_output_id].path;
     ++blocks_state_[target_block_id].cnt_inputs_ready;
     blocks_state_[target_block_id].input_sources[target_input_id].emplace(source_output_path);
+    blocks_state_[target_block_id].input_nodes[target_input_id] =
+        blocks_state_[source_block_id].node;
+    blocks_state_[target_block_id].input_sizes[target_input_id] =
+        blocks_state_[source_block_id].output_files[source_output_id]->size;
+    const auto &output_digest = blocks_state_[source_block_id].output_digests[source_output_id];
+    if (!output_digest.empty()) {
+        blocks_state_[target_block_id].input_digests[target_input_id].emplace(output_digest);
+    }
     return true;
 }
 
@@ -147,11 +656,228 @@ bool WorkflowState::IsBlockReady(size_t block_id) const {
     return blocks_state_[block_id].cnt_inputs_ready == blocks[block_id].inputs.size();
 }
 
+std::string WorkflowState::GetPreferredNode(size_t block_id) const {
+    // The node that produced the largest share of the inputs by size. Empty files count as one
+    // byte, so that a block with small inputs still follows them.
+    const auto &block_state = blocks_state_[block_id];
+    std::unordered_map<std::string, int64_t> node_sizes;
+    for (size_t input_id = 0; input_id < block_state.input_nodes.size(); ++input_id) {
+        if (!block_state.input_nodes[input_id].empty()) {
+            node_sizes[block_state.input_nodes[input_id]] +=
+                std::max<int64_t>(block_state.input_sizes[input_id], 1);
+        }
+    }
+    std::string preferred_node;
+    int64_t preferred_size = 0;
+    for (const auto &[node, size] : node_sizes) {
+        if (size > preferred_size) {
+            preferred_node = node;
+            preferred_size = size;
+        }
+    }
+    return preferred_node;
+}
+
+std::optional<std::string> WorkflowState::GetRequiredNode(size_t block_id) const {
+    // A FIFO only connects processes of the same machine. A consumer that is cancelled anyway
+    // may go anywhere.
+    if (!graph_->stream_source[block_id].has_value() || blocks_state_[block_id].stream_cancelled) {
+        return std::nullopt;
+    }
+    return blocks_state_[graph_->stream_source[block_id].value()].node;
+}
+
+void WorkflowState::ConnectStreams(size_t block_id) {
+    // Consumers of the streaming outputs of a dispatched block are started right away, bypassing
+    // max_runners, since the producer blocks on the FIFO until they open it.
+    for (const auto &connection : graph_->go[block_id]) {
+        const auto &[source_block_id, source_output_id, target_block_id, target_input_id] =
+            connection;
+        const auto &output = blocks[source_block_id].outputs[source_output_id];
+        auto &target_state = blocks_state_[target_block_id];
+        if (!output.streaming || target_state.input_sources[target_input_id]) {
+            continue;
+        }
+        ++target_state.cnt_inputs_ready;
+        target_state.input_sources[target_input_id].emplace(
+            (fs::path(blocks_state_[source_block_id].container_path) / output.path).string());
+        target_state.input_nodes[target_input_id] = blocks_state_[source_block_id].node;
+        if (!IsBlockReady(target_block_id) || blocks_processing_.contains(target_block_id)) {
+            continue;
+        }
+        blocks_processing_.insert(target_block_id);
+        if (!replaying_) {
+            partition_ptr->EnqueueBlock(this, target_block_id);
+        }
+    }
+}
+
+void WorkflowState::CancelStreamPeers(size_t block_id) {
+    // A peer that has not reached a runner yet is finished as cancelled once it does.
+    for (size_t peer_id : graph_->stream_peers[block_id]) {
+        if (!blocks_processing_.contains(peer_id)) {
+            continue;
+        }
+        if (!blocks_state_[peer_id].dispatched) {
+            blocks_state_[peer_id].stream_cancelled = true;
+        } else if (!replaying_) {
+            partition_ptr->CancelBlock(this, peer_id);
+        }
+    }
+}
+
+void WorkflowState::FindComponents(WorkflowGraph &graph) {
+    // Iterative Tarjan's algorithm: strongly connected components are found in reverse
+    // topological order, so every component is preceded by all components reachable from it.
+    const size_t unvisited = graph.go.size();
+    std::vector<size_t> index(graph.go.size(), unvisited), low(graph.go.size());
+    std::vector<bool> on_stack(graph.go.size());
+    std::vector<size_t> stack;
+    std::vector<std::pair<size_t, size_t>> dfs;
+    size_t timer = 0;
+    auto visit = [&](size_t block_id) {
+        index[block_id] = low[block_id] = timer++;
+        stack.push_back(block_id);
+        on_stack[block_id] = true;
+        dfs.emplace_back(block_id, 0);
+    };
+    graph.component.assign(graph.go.size(), 0);
+    graph.components.clear();
+    for (size_t root = 0; root < graph.go.size(); ++root) {
+        if (index[root] != unvisited) {
+            continue;
+        }
+        visit(root);
+        while (!dfs.empty()) {
+            auto [block_id, edge_id] = dfs.back();
+            if (edge_id < graph.go[block_id].size()) {
+                ++dfs.back().second;
+                size_t target_block_id = graph.go[block_id][edge_id].target_block_id;
+                if (index[target_block_id] == unvisited) {
+                    visit(target_block_id);
+                } else if (on_stack[target_block_id]) {
+                    low[block_id] = std::min(low[block_id], index[target_block_id]);
+                }
+                continue;
+            }
+            dfs.pop_back();
+            if (!dfs.empty()) {
+                size_t parent_id = dfs.back().first;
+                low[parent_id] = std::min(low[parent_id], low[block_id]);
+            }
+            if (low[block_id] == index[block_id]) {
+                auto &component = graph.components.emplace_back();
+                size_t member_id;
+                do {
+                    member_id = stack.back();
+                    stack.pop_back();
+                    on_stack[member_id] = false;
+                    graph.component[member_id] = graph.components.size() - 1;
+                    component.push_back(member_id);
+                } while (member_id != block_id);
+            }
+        }
+    }
+}
+
+void WorkflowState::UpdatePriorities() {
+    // Priority of a block is the weight of the longest path from it to a sink in the graph of
+    // strongly connected components, where a block weighs its last wall time usage, or the mean
+    // usage of the measured blocks if it has none. Components come in reverse topological order,
+    // so the ones downstream of a component are done before it.
+    int64_t total_usage_ms = 0;
+    size_t cnt_measured = 0;
+    for (const auto &block_state : blocks_state_) {
+        if (block_state.wall_time_usage_ms.has_value()) {
+            total_usage_ms += block_state.wall_time_usage_ms.value();
+            ++cnt_measured;
+        }
+    }
+    default_weight_ = cnt_measured == 0 ? 1 : std::max<int64_t>(total_usage_ms / cnt_measured, 1);
+    component_priorities_.assign(graph_->components.size(), 0);
+    for (size_t component_id = 0; component_id < graph_->components.size(); ++component_id) {
+        component_priorities_[component_id] = GetComponentPriority(component_id);
+        for (size_t block_id : graph_->components[component_id]) {
+            blocks_state_[block_id].priority = component_priorities_[component_id];
+        }
+    }
+}
+
+void WorkflowState::UpdatePriorities(size_t block_id) {
+    // A block that finishes changes its own weight, and so the priorities of its component and
+    // of those upstream of it, while the default weight stays as it was until the run is over.
+    // Components are revisited from the sinks up, and only past those whose priority changed.
+    // Blocks that are ready already are reordered if any of them is affected.
+    std::set<size_t> components_pending = {graph_->component[block_id]};
+    bool reorder = false;
+    while (!components_pending.empty()) {
+        size_t component_id = *components_pending.begin();
+        components_pending.erase(components_pending.begin());
+        int64_t priority = GetComponentPriority(component_id);
+        if (priority == component_priorities_[component_id]) {
+            continue;
+        }
+        component_priorities_[component_id] = priority;
+        for (size_t member_id : graph_->components[component_id]) {
+            blocks_state_[member_id].priority = priority;
+            reorder = reorder || cnt_ready_[member_id] > 0;
+        }
+        components_pending.insert(graph_->upstream[component_id].begin(),
+                                  graph_->upstream[component_id].end());
+    }
+    if (reorder) {
+        ReorderReadyBlocks();
+    }
+}
+
+int64_t WorkflowState::GetComponentPriority(size_t component_id) const {
+    int64_t weight = 0, downstream = 0;
+    for (size_t block_id : graph_->components[component_id]) {
+        weight += blocks_state_[block_id].wall_time_usage_ms.value_or(default_weight_);
+        for (const auto &connection : graph_->go[block_id]) {
+            size_t target_component_id = graph_->component[connection.target_block_id];
+            if (target_component_id != component_id) {
+                downstream = std::max(downstream, component_priorities_[target_component_id]);
+            }
+        }
+    }
+    return weight + downstream;
+}
+
+void WorkflowState::ReorderReadyBlocks() {
+    std::vector<ReadyBlock> ready_blocks;
+    ready_blocks.reserve(blocks_ready_.size());
+    while (!blocks_ready_.empty()) {
+        ReadyBlock ready_block = blocks_ready_.top();
+        blocks_ready_.pop();
+        ready_block.priority = blocks_state_[ready_block.block_id].priority;
+        ready_blocks.push_back(ready_block);
+    }
+    blocks_ready_ =
+        std::priority_queue<ReadyBlock>(std::less<ReadyBlock>(), std::move(ready_blocks));
+}
+
 void WorkflowState::PrepareRun(size_t block_id) {
     fs::path container_path =
         fs::path(CONTAINERS_DIR) / GetContainerId(block_id, blocks_state_[block_id].cnt_runs);
+    blocks_state_[block_id].container_path = container_path.string();
     fs::create_directories(container_path);
     fs::permissions(container_path, fs::perms::all, fs::perm_options::add);
+    for (const auto &output : blocks[block_id].outputs) {
+        if (!output.streaming) {
+            continue;
+        }
+        fs::path fifo_path = container_path / output.path;
+        fs::create_directories(fifo_path.parent_path());
+        if (mkfifo(fifo_path.c_str(), 0666) != 0) {
+            throw fs::filesystem_error("cannot create fifo", fifo_path,
+                                       std::error_code(errno, std::generic_category()));
+        }
+        fs::permissions(fifo_path, fs::perms::owner_read | fs::perms::owner_write |
+                                       fs::perms::group_read | fs::perms::group_write |
+                                       fs::perms::others_read | fs::perms::others_write,
+                        fs::perm_options::add);
+    }
 }
 
 void WorkflowState::FinalizeRun(size_t block_id) {
@@ -160,107 +886,1265 @@ void WorkflowState::FinalizeRun(size_t block_id) {
     for (size_t input_id = 0; input_id < blocks[block_id].inputs.size(); ++input_id) {
         if (!blocks[block_id].inputs[input_id].cached) {
             blocks_state_[block_id].input_sources[input_id].reset();
+            blocks_state_[block_id].input_digests[input_id].reset();
+            blocks_state_[block_id].input_nodes[input_id].clear();
+            blocks_state_[block_id].input_sizes[input_id] = 0;
         } else {
             ++blocks_state_[block_id].cnt_inputs_ready;
         }
     }
 }
 
-void WorkflowState::SendRunRequest(size_t block_id, RunnerWebSocket *ws) {
-    fs::path container_path =
-        fs::path(CONTAINERS_DIR) / GetContainerId(block_id, blocks_state_[block_id].cnt_runs);
-    std::vector<Bind> binds = {
-        {.inside = ".", .outside = container_path.string(), .readonly = false}};
-    for (size_t input_id = 0; input_id < blocks[block_id].inputs.size(); ++input_id) {
-        binds.push_back({.inside = blocks[block_id].inputs[input_id].path,
-                         .outside = blocks_state_[block_id].input_sources[input_id].value(),
-                         .readonly = true});
+std::string SpliceRunRequest(const std::vector<std::string> &parts, std::string_view task_id,
+                             const std::string &container_path,
+                             const std::vector<std::optional<std::string>> &input_sources,
+                             void (*append_path)(std::string &, std::string_view)) {
+    size_t size = task_id.size() + container_path.size();
+    for (const auto &part : parts) {
+        size += part.size();
+    }
+    for (const auto &input_source : input_sources) {
+        size += input_source->size();
+    }
+    std::string request;
+    request.reserve(size + size / 16);
+    request.append(parts[0]).append(task_id).append(parts[1]);
+    append_path(request, container_path);
+    for (size_t input_id = 0; input_id < input_sources.size(); ++input_id) {
+        request.append(parts[input_id + 2]);
+        append_path(request, input_sources[input_id].value());
+    }
+    request.append(parts.back());
+    return request;
+}
+
+void WorkflowState::SendRunRequest(size_t block_id, size_t task_id, const RunnerState &runner,
+                                   const std::string &container_path) {
+    // The request is spliced from the parts serialized at Init: the task id goes after the first
+    // one, the container after the second, and the input sources after the rest in order.
+    const auto &input_sources = blocks_state_[block_id].input_sources;
+    std::string request;
+    if (runner.wire_version > 0) {
+        std::string task_id_bytes;
+        Encode(task_id, task_id_bytes);
+        request = SpliceRunRequest(wire_run_request_parts_[block_id], task_id_bytes,
+                                   container_path, input_sources, AppendWireString);
+        // The parts are encoded once for all runners, and the frame is stamped with the version
+        // negotiated with this one.
+        request[1] = static_cast<char>(runner.wire_version);
+    } else {
+        char task_id_text[24];
+        auto task_id_end =
+            std::to_chars(std::begin(task_id_text), std::end(task_id_text), task_id).ptr;
+        request = SpliceRunRequest(run_request_parts_[block_id],
+                                   std::string_view(task_id_text, task_id_end - task_id_text),
+                                   container_path, input_sources, AppendEscapedJSON);
+    }
+    scheduler_ptr->SendToRunner(runner.socket, std::move(request));
+}
+
+RunRequest WorkflowState::BuildRunRequest(size_t block_id) const {
+    // Outside paths of the container and the inputs are left empty, to be spliced in on dispatch.
+    const auto &block = blocks[block_id];
+    RunRequest request = {.task_id = 0,
+                          .binds = {{.inside = ".", .outside = "", .readonly = false}},
+                          .argv = block.argv,
+                          .env = block.env,
+                          .constraints = block.constraints};
+    for (const auto &input : block.inputs) {
+        request.binds.push_back({.inside = input.path, .outside = "", .readonly = true});
     }
-    for (const auto &bind : blocks[block_id].binds) {
-        binds.push_back(
+    for (const auto &bind : block.binds) {
+        request.binds.push_back(
             {.inside = bind.inside, .outside = bind.outside, .readonly = bind.readonly});
     }
-    RunRequest request = {.binds = std::move(binds),
-                          .argv = blocks[block_id].argv,
-                          .env = blocks[block_id].env,
-                          .constraints = blocks[block_id].constraints};
-    ws->send(StringifyJSON(Serialize(request)));
+    for (const auto &output : block.outputs) {
+        request.outputs.push_back(output.path);
+    }
+    return request;
+}
+
+std::vector<std::string> WorkflowState::BuildRunRequestParts(size_t block_id) const {
+    // The request is serialized and cut right after the opening quote of each outside path left
+    // empty by BuildRunRequest.
+    std::string_view text = ToJSON(BuildRunRequest(block_id));
+    const std::string task_id_prefix = "{\"task-id\":", outside_prefix = "\"outside\":\"";
+    std::vector<std::string> parts = {task_id_prefix};
+    size_t position = task_id_prefix.size() + 1;
+    for (size_t bind_id = 0; bind_id <= blocks[block_id].inputs.size(); ++bind_id) {
+        size_t end = text.find(outside_prefix, position) + outside_prefix.size();
+        parts.emplace_back(text.substr(position, end - position));
+        position = end;
+    }
+    parts.emplace_back(text.substr(position));
+    return parts;
+}
+
+std::vector<std::string> WorkflowState::BuildWireRunRequestParts(size_t block_id) const {
+    // Follows Encode<RunRequest> field by field, cutting in place of the task id and of each
+    // outside path left empty by BuildRunRequest.
+    RunRequest request = BuildRunRequest(block_id);
+    std::vector<std::string> parts(1);
+    EncodeHeader(parts.back());
+    parts.emplace_back();
+    EncodeInteger(static_cast<uint32_t>(request.binds.size()), parts.back());
+    for (size_t bind_id = 0; bind_id < request.binds.size(); ++bind_id) {
+        const auto &bind = request.binds[bind_id];
+        if (bind_id > blocks[block_id].inputs.size()) {
+            Encode(bind, parts.back());
+            continue;
+        }
+        Encode(bind.inside, parts.back());
+        parts.emplace_back();
+        Encode(bind.readonly, parts.back());
+    }
+    Encode(request.argv, parts.back());
+    Encode(request.env, parts.back());
+    Encode(request.constraints, parts.back());
+    Encode(request.outputs, parts.back());
+    return parts;
 }
 
-void WorkflowState::AddClient(ClientWebSocket *ws) {
-    clients_.insert(ws);
+void WorkflowState::AddClient(const SocketRef &client, std::optional<size_t> after) {
+    if (clients_.emplace(client.socket_id, client).second) {
+        ++client_shards_[client.shard_id];
+    }
+    watched_ = true;
+    // A client that resumes gets the events after the last one it has seen, or the current state
+    // of the workflow when some of them are no longer kept or were never numbered here, as after
+    // a restart of the scheduler.
+    std::vector<std::shared_ptr<const std::string>> replay;
+    if (after.has_value()) {
+        if (after.value() <= cnt_events_ && cnt_events_ - after.value() <= events_.size()) {
+            for (size_t seq = after.value() + 1; seq <= cnt_events_; ++seq) {
+                replay.push_back(events_[seq % events_.size()]);
+            }
+        } else {
+            replay.push_back(std::make_shared<const std::string>(
+                ToJSON(GetClientSnapshot(), SNAPSHOT_SIGNAL " ")));
+        }
+    }
+    scheduler_ptr->SubscribeClient(client, workflow_id, std::move(replay));
 }
 
-void WorkflowState::RemoveClient(ClientWebSocket *ws) {
-    clients_.erase(ws);
+void WorkflowState::RemoveClient(const SocketRef &client) {
+    if (clients_.erase(client.socket_id) && --client_shards_[client.shard_id] == 0) {
+        client_shards_.erase(client.shard_id);
+    }
 }
 
 void WorkflowState::SendToAllClients(std::string_view message) {
-    for (ClientWebSocket *ws : clients_) {
-        ws->send(message, uWS::OpCode::TEXT);
+    if (!watched_) {
+        return;
     }
+    size_t seq = ++cnt_events_;
+    std::string event = EVENT_SIGNAL " " + std::to_string(seq) + " ";
+    event += message;
+    auto shared_message = std::make_shared<const std::string>(std::move(event));
+    size_t capacity = std::max(Config::Get().scheduler_client_replay_events, 0);
+    if (capacity > 0) {
+        events_.resize(capacity);
+        events_[seq % capacity] = shared_message;
+    }
+    // Clients are subscribed to the topic of the workflow on the shard that accepted them, so a
+    // message is published once per such shard rather than sent once per client.
+    for (const auto &[shard_id, cnt_clients] : client_shards_) {
+        scheduler_ptr->PublishToClients(shard_id, workflow_id, shared_message);
+    }
+}
+
+void WorkflowState::SendBlockResponse(const BlockResponse &response) {
+    if (!watched_) {
+        return;
+    }
+    int batch_ms = Config::Get().scheduler_client_batch_ms;
+    if (batch_ms <= 0) {
+        SendToAllClients(ToJSON(response, BLOCK_SIGNAL " "));
+        return;
+    }
+    // Updates are held back for a while and go out together in one message. The workflow is
+    // looked up again when the timer fires, since it may have been archived in the meantime.
+    pending_responses_.push_back(response);
+    if (pending_responses_.size() == 1) {
+        size_t shard_id = scheduler_ptr->GetShardId(meta.partition);
+        scheduler_ptr->PostDelayed(
+            shard_id, batch_ms,
+            [scheduler_ptr = scheduler_ptr, shard_id, workflow_id = workflow_id] {
+                if (WorkflowState *workflow_ptr =
+                        scheduler_ptr->FindWorkflow(shard_id, workflow_id)) {
+                    workflow_ptr->FlushBlockResponses();
+                }
+            });
+    }
+}
+
+void WorkflowState::FlushBlockResponses() {
+    if (pending_responses_.empty()) {
+        return;
+    }
+    SendToAllClients(ToJSON(pending_responses_, BLOCK_BATCH_SIGNAL " "));
+    pending_responses_.clear();
+}
+
+ClientSnapshot WorkflowState::GetClientSnapshot() const {
+    ClientSnapshot snapshot = {.seq = cnt_events_, .running = is_running_};
+    for (size_t block_id = 0; block_id < blocks.size(); ++block_id) {
+        const auto &block_state = blocks_state_[block_id];
+        // Blocks that have not been dispatched in the current run are still pending.
+        if (block_state.last_workflow_run != cnt_workflow_runs_) {
+            continue;
+        }
+        if (block_state.dispatched) {
+            snapshot.blocks.push_back({.block_id = block_id, .state = RUNNING_STATE});
+        } else if (blocks_processing_.contains(block_id) && block_state.cnt_retries > 0) {
+            snapshot.blocks.push_back({.block_id = block_id,
+                                       .state = RETRYING_STATE,
+                                       .error = RUNNER_LOST_ERROR,
+                                       .retry = block_state.cnt_retries});
+        } else if (block_state.last_response.has_value()) {
+            snapshot.blocks.push_back(block_state.last_response.value());
+        } else {
+            continue;
+        }
+        snapshot.cnt_runs.push_back(block_state.cnt_dispatches);
+    }
+    return snapshot;
 }
 
 std::string WorkflowState::GetContainerId(size_t block_id, size_t run_id) const {
     return workflow_id + "_" + std::to_string(block_id) + "_" + std::to_string(run_id);
 }
 
-void Partition::AddRunner(RunnerWebSocket *ws) {
-    if (blocks_waiting_.empty()) {
-        runners_waiting_.insert(ws);
-    } else {
-        auto [workflow_ptr, block_id] = blocks_waiting_.front();
-        blocks_waiting_.pop();
-        workflow_ptr->RunBlock(block_id, ws);
+std::optional<std::string> WorkflowState::GetCacheKey(size_t block_id) const {
+    // The key covers the request sent to the runner, with input files replaced by digests of
+    // their contents. User binds are only identified by their metadata, and a block with a
+    // writable one may have side effects, so it is never cached.
+    const auto &block = blocks[block_id];
+    if (!block.cache_results || !graph_->stream_peers[block_id].empty()) {
+        return std::nullopt;
+    }
+    auto binds_digest = GetBindsDigest(block_id);
+    if (!binds_digest.has_value()) {
+        return std::nullopt;
+    }
+    RunRequest request = {.task_id = 0, .argv = block.argv, .env = block.env,
+                          .constraints = block.constraints};
+    try {
+        // Inputs coming from outputs with a reported digest are not hashed again.
+        for (size_t input_id = 0; input_id < block.inputs.size(); ++input_id) {
+            const auto &input_digest = blocks_state_[block_id].input_digests[input_id];
+            const auto &input_source = blocks_state_[block_id].input_sources[input_id].value();
+            request.binds.push_back(
+                {.inside = block.inputs[input_id].path,
+                 .outside = input_digest.has_value()
+                                ? input_digest.value()
+                                : ResultCache::Get().GetContentDigest(input_source),
+                 .readonly = true});
+        }
+    } catch (const fs::filesystem_error &) {
+        return std::nullopt;
+    }
+    Digest digest;
+    digest.Update(binds_digest.value());
+    digest.Update(ToJSON(request));
+    for (const auto &output : block.outputs) {
+        digest.Update(output.path);
     }
+    return digest.Hex();
 }
 
-void Partition::RemoveRunner(RunnerWebSocket *ws) {
-    runners_waiting_.erase(ws);
+std::optional<std::string> WorkflowState::GetBindsDigest(size_t block_id) const {
+    Digest digest;
+    try {
+        for (const auto &bind : blocks[block_id].binds) {
+            if (!bind.readonly) {
+                return std::nullopt;
+            }
+            digest.Update(bind.inside);
+            digest.Update(ResultCache::Get().GetMetadataDigest(bind.outside));
+        }
+    } catch (const fs::filesystem_error &) {
+        return std::nullopt;
+    }
+    return digest.Hex();
+}
+
+bool WorkflowState::ReuseCachedResult(size_t block_id) {
+    auto &block_state = blocks_state_[block_id];
+    block_state.cache_key = GetCacheKey(block_id);
+    if (!block_state.cache_key.has_value()) {
+        return false;
+    }
+    auto result = ResultCache::Get().Find(block_state.cache_key.value());
+    if (!result.has_value()) {
+        return false;
+    }
+    for (const auto &output : blocks[block_id].outputs) {
+        if (std::none_of(result->manifest.begin(), result->manifest.end(),
+                         [&](const OutputFile &output_file) {
+                             return output_file.path == output.path;
+                         })) {
+            return false;
+        }
+    }
+    if (block_state.last_workflow_run != cnt_workflow_runs_) {
+        block_state.cnt_dispatches = 0;
+    }
+    block_state.last_workflow_run = cnt_workflow_runs_;
+    block_state.container_path = result->container_path;
+    block_state.node = result->node;
+    AppendEvent({.type = DISPATCH_EVENT,
+                 .workflow_id = workflow_id,
+                 .block_id = block_id,
+                 .container_path = block_state.container_path,
+                 .node = block_state.node});
+    Log("Workflow ", workflow_id, ": block ", block_id, " reuses cached result from ",
+        result->container_path);
+    FinishBlock(block_id, {.status = result->status,
+                           .output_digests = result->output_digests,
+                           .manifest = result->manifest});
+    return true;
+}
+
+void WorkflowState::AppendEvent(const JournalEvent &event) {
+    if (!replaying_) {
+        scheduler_ptr->AppendEvent(scheduler_ptr->GetShardId(meta.partition), event);
+    }
+}
+
+void Partition::AddRunner(const SocketRef &socket, int runner_id, const std::string &node,
+                          const Resources &capacity, int wire_version) {
+    runners_[socket.socket_id] = {.runner_id = runner_id,
+                                  .node = node,
+                                  .wire_version = wire_version,
+                                  .socket = socket,
+                                  .capacity = capacity,
+                                  .usage = {0, 0, 0},
+                                  .tasks = {}};
+    Dispatch();
+}
+
+void Partition::RemoveRunner(const SocketRef &socket) {
+    auto iter = runners_.find(socket.socket_id);
+    if (iter == runners_.end()) {
+        return;
+    }
+    auto tasks = std::move(iter->second.tasks);
+    runners_.erase(iter);
+    for (const auto &[task_id, task] : tasks) {
+        // A block that has another copy running elsewhere only loses this one.
+        auto speculation_iter = speculations_.find({task.workflow_ptr, task.block_id});
+        if (speculation_iter != speculations_.end()) {
+            speculations_.erase(speculation_iter);
+            task.workflow_ptr->ResolveSpeculation(task.block_id, !task.speculative);
+            continue;
+        }
+        task.workflow_ptr->OnRunnerLost(task.block_id);
+    }
+    Dispatch();
 }
 
 void Partition::EnqueueBlock(WorkflowState *workflow_ptr, size_t block_id) {
-    if (runners_waiting_.empty()) {
-        blocks_waiting_.emplace(workflow_ptr, block_id);
+    auto &queue = blocks_waiting_[workflow_ptr];
+    if (queue.blocks.empty()) {
+        workflows_waiting_.push_back(workflow_ptr);
+    }
+    queue.blocks.push({.block_id = block_id,
+                       .node = workflow_ptr->GetPreferredNode(block_id),
+                       .enqueue_time = std::chrono::steady_clock::now()});
+    Dispatch();
+}
+
+void Partition::CancelWorkflow(WorkflowState *workflow_ptr) {
+    for (const auto &[socket_id, runner] : runners_) {
+        for (const auto &[task_id, task] : runner.tasks) {
+            if (task.workflow_ptr == workflow_ptr) {
+                workflow_ptr->scheduler_ptr->SendToRunner(
+                    runner.socket, CANCEL_SIGNAL + std::string(" ") + std::to_string(task_id));
+            }
+        }
+    }
+    blocks_waiting_.erase(workflow_ptr);
+    workflows_waiting_.erase(
+        std::remove(workflows_waiting_.begin(), workflows_waiting_.end(), workflow_ptr),
+        workflows_waiting_.end());
+}
+
+void Partition::CancelBlock(WorkflowState *workflow_ptr, size_t block_id) {
+    for (const auto &[socket_id, runner] : runners_) {
+        for (const auto &[task_id, task] : runner.tasks) {
+            if (task.workflow_ptr == workflow_ptr && task.block_id == block_id) {
+                workflow_ptr->scheduler_ptr->SendToRunner(
+                    runner.socket, CANCEL_SIGNAL + std::string(" ") + std::to_string(task_id));
+            }
+        }
+    }
+}
+
+void Partition::OnStatus(const SocketRef &socket, const RunResponse &run_response) {
+    auto runner_iter = runners_.find(socket.socket_id);
+    if (runner_iter == runners_.end()) {
+        return;
+    }
+    auto &runner = runner_iter->second;
+    auto iter = runner.tasks.find(run_response.task_id);
+    if (iter == runner.tasks.end()) {
+        LogWarning("Runner ", runner.runner_id, ": unknown task ", run_response.task_id);
+        return;
+    }
+    RunnerTask task = iter->second;
+    runner.tasks.erase(iter);
+    runner.usage -= task.demand;
+    // Of the two copies of a block the first one to succeed is taken and the other one is
+    // cancelled. A copy that fails is dropped as long as the other one is still running.
+    auto speculation_iter = speculations_.find({task.workflow_ptr, task.block_id});
+    if (speculation_iter != speculations_.end()) {
+        auto [original, copy] = speculation_iter->second;
+        speculations_.erase(speculation_iter);
+        TaskRef sibling = task.speculative ? original : copy;
+        bool succeeded = run_response.status.has_value() && run_response.status->exited &&
+                         run_response.status->exit_code == 0;
+        if (!succeeded) {
+            task.workflow_ptr->ResolveSpeculation(task.block_id, !task.speculative);
+            Dispatch();
+            return;
+        }
+        // The sibling may be gone already, its runner having disconnected in the meantime.
+        auto sibling_runner_iter = runners_.find(sibling.socket_id);
+        if (sibling_runner_iter != runners_.end()) {
+            auto &sibling_runner = sibling_runner_iter->second;
+            auto sibling_iter = sibling_runner.tasks.find(sibling.task_id);
+            if (sibling_iter != sibling_runner.tasks.end()) {
+                sibling_runner.usage -= sibling_iter->second.demand;
+                sibling_runner.tasks.erase(sibling_iter);
+                task.workflow_ptr->scheduler_ptr->SendToRunner(
+                    sibling_runner.socket,
+                    CANCEL_SIGNAL + std::string(" ") + std::to_string(sibling.task_id));
+            }
+        }
+        task.workflow_ptr->ResolveSpeculation(task.block_id, task.speculative);
+    }
+    task.workflow_ptr->OnStatus(task.block_id, run_response);
+    Dispatch();
+}
+
+void Partition::Speculate() {
+    // Stragglers get a copy on a runner that has nothing to do, on another node if possible,
+    // and only while no block is waiting for a runner.
+    int factor = Config::Get().scheduler_speculation_factor;
+    if (factor <= 0 || !workflows_waiting_.empty()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::vector<TaskRef> stragglers;
+    for (const auto &[socket_id, runner] : runners_) {
+        for (const auto &[task_id, task] : runner.tasks) {
+            if (task.speculative || speculations_.contains({task.workflow_ptr, task.block_id})) {
+                continue;
+            }
+            auto expected_ms = task.workflow_ptr->GetExpectedWallTimeMs(task.block_id);
+            if (expected_ms.has_value() &&
+                now - task.start_time > std::chrono::milliseconds(expected_ms.value() * factor) &&
+                task.workflow_ptr->CanSpeculate(task.block_id)) {
+                stragglers.push_back({.socket_id = socket_id, .task_id = task_id});
+            }
+        }
+    }
+    for (const auto &straggler : stragglers) {
+        const auto &straggler_runner = runners_.at(straggler.socket_id);
+        RunnerTask task = straggler_runner.tasks.at(straggler.task_id);
+        RunnerState *idle_runner_ptr = nullptr;
+        for (auto &[socket_id, runner] : runners_) {
+            if (!runner.tasks.empty() || socket_id == straggler.socket_id) {
+                continue;
+            }
+            if (!idle_runner_ptr || (idle_runner_ptr->node == straggler_runner.node &&
+                                     runner.node != straggler_runner.node)) {
+                idle_runner_ptr = &runner;
+            }
+        }
+        if (!idle_runner_ptr) {
+            return;
+        }
+        size_t task_id = cnt_tasks_++;
+        idle_runner_ptr->usage += task.demand;
+        idle_runner_ptr->tasks[task_id] = {.workflow_ptr = task.workflow_ptr,
+                                           .block_id = task.block_id,
+                                           .demand = task.demand,
+                                           .start_time = now,
+                                           .speculative = true};
+        if (!task.workflow_ptr->RunSpeculativeCopy(task.block_id, task_id, *idle_runner_ptr)) {
+            idle_runner_ptr->usage -= task.demand;
+            idle_runner_ptr->tasks.erase(task_id);
+            continue;
+        }
+        speculations_[{task.workflow_ptr, task.block_id}] = {
+            straggler, {.socket_id = idle_runner_ptr->socket.socket_id, .task_id = task_id}};
+    }
+}
+
+void Partition::Dispatch() {
+    // Delay scheduling: a block whose inputs mostly live on one node waits for a runner there
+    // for up to scheduler_locality_wait_ms, while blocks of the workflows behind it go first.
+    // A block that fits no runner at all still holds up the whole partition. The consumer of a
+    // stream runs on the node of its producer even if that overcommits the runner there, since
+    // the producer cannot finish until the consumer starts.
+    auto now = std::chrono::steady_clock::now();
+    auto locality_wait = std::chrono::milliseconds(Config::Get().scheduler_locality_wait_ms);
+    size_t position = 0;
+    while (position < workflows_waiting_.size()) {
+        WorkflowState *workflow_ptr = workflows_waiting_[position];
+        const auto &block = blocks_waiting_.at(workflow_ptr).blocks.front();
+        Resources demand = GetDemand(workflow_ptr->blocks[block.block_id].constraints);
+        auto required_node = workflow_ptr->GetRequiredNode(block.block_id);
+        RunnerState *runner_ptr = nullptr;
+        if (required_node.has_value()) {
+            runner_ptr = FindRunner(demand, required_node.value());
+            if (!runner_ptr && !(runner_ptr = FindNodeRunner(required_node.value()))) {
+                ++position;
+                continue;
+            }
+        } else if (!(runner_ptr = FindRunner(demand))) {
+            return;
+        } else if (!block.node.empty() && runner_ptr->node != block.node) {
+            if (RunnerState *local_runner_ptr = FindRunner(demand, block.node)) {
+                runner_ptr = local_runner_ptr;
+            } else if (now < block.enqueue_time + locality_wait) {
+                ScheduleDispatch(workflow_ptr, block.enqueue_time + locality_wait);
+                ++position;
+                continue;
+            }
+        }
+        size_t block_id = block.block_id;
+        DequeueBlock(position);
+        position = 0;
+        size_t task_id = cnt_tasks_++;
+        runner_ptr->usage += demand;
+        runner_ptr->tasks[task_id] = {.workflow_ptr = workflow_ptr,
+                                      .block_id = block_id,
+                                      .demand = demand,
+                                      .start_time = now};
+        workflow_ptr->RunBlock(block_id, task_id, *runner_ptr);
+    }
+}
+
+void Partition::ScheduleDispatch(WorkflowState *workflow_ptr,
+                                 std::chrono::steady_clock::time_point deadline) {
+    if (dispatch_deadline_ <= deadline) {
+        return;
+    }
+    dispatch_deadline_ = deadline;
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    Scheduler *scheduler_ptr = workflow_ptr->scheduler_ptr;
+    scheduler_ptr->PostDelayed(scheduler_ptr->GetShardId(workflow_ptr->meta.partition),
+                               static_cast<int>(delay.count()) + 1, [this, deadline] {
+                                   if (dispatch_deadline_ == deadline) {
+                                       dispatch_deadline_ =
+                                           std::chrono::steady_clock::time_point::max();
+                                   }
+                                   Dispatch();
+                               });
+}
+
+RunnerState *Partition::FindRunner(const Resources &demand, const std::string &node) {
+    // Best fit: among the runners the block fits into, take the one with the fewest spare cpus.
+    // An idle runner accepts any block, so that oversized blocks do not wait forever.
+    RunnerState *best_runner_ptr = nullptr;
+    int64_t best_spare_cpus = 0;
+    for (auto &[socket_id, runner] : runners_) {
+        if (!node.empty() && runner.node != node) {
+            continue;
+        }
+        Resources usage = runner.usage;
+        usage += demand;
+        if (!runner.tasks.empty() && !usage.Fits(runner.capacity)) {
+            continue;
+        }
+        int64_t spare_cpus = runner.capacity.cpus - usage.cpus;
+        if (!best_runner_ptr || spare_cpus < best_spare_cpus) {
+            best_runner_ptr = &runner;
+            best_spare_cpus = spare_cpus;
+        }
+    }
+    return best_runner_ptr;
+}
+
+RunnerState *Partition::FindNodeRunner(const std::string &node) {
+    RunnerState *best_runner_ptr = nullptr;
+    int64_t best_spare_cpus = 0;
+    for (auto &[socket_id, runner] : runners_) {
+        int64_t spare_cpus = runner.capacity.cpus - runner.usage.cpus;
+        if (runner.node == node && (!best_runner_ptr || spare_cpus > best_spare_cpus)) {
+            best_runner_ptr = &runner;
+            best_spare_cpus = spare_cpus;
+        }
+    }
+    return best_runner_ptr;
+}
+
+void Partition::DequeueBlock(size_t position) {
+    // Deficit round-robin with unit cost: the workflow at the front keeps its turn until it has
+    // dispatched meta.weight blocks or runs out of them. A workflow further back that dispatches
+    // while the ones before it wait for locality keeps its place.
+    WorkflowState *workflow_ptr = workflows_waiting_[position];
+    workflows_waiting_.erase(workflows_waiting_.begin() + position);
+    auto &queue = blocks_waiting_[workflow_ptr];
+    if (queue.deficit == 0) {
+        queue.deficit = workflow_ptr->meta.weight;
+    }
+    queue.blocks.pop();
+    --queue.deficit;
+    if (queue.blocks.empty()) {
+        blocks_waiting_.erase(workflow_ptr);
+    } else if (queue.deficit == 0) {
+        workflows_waiting_.push_back(workflow_ptr);
+    } else {
+        workflows_waiting_.insert(workflows_waiting_.begin() + position, workflow_ptr);
+    }
+}
+
+Scheduler::Scheduler(size_t cnt_shards) : shards_(std::max<size_t>(cnt_shards, 1)) {
+}
+
+size_t Scheduler::CountShards() const {
+    return shards_.size();
+}
+
+size_t Scheduler::GetShardId(const std::string &partition) const {
+    return std::hash<std::string>{}(partition) % shards_.size();
+}
+
+void Scheduler::AttachShard(size_t shard_id, uWS::Loop *loop, uWS::App *app) {
+    shards_[shard_id].loop = loop;
+    shards_[shard_id].app = app;
+    current_shard_id_ = shard_id;
+    ScheduleEviction(shard_id);
+    ScheduleSpeculation(shard_id);
+}
+
+void Scheduler::Post(size_t shard_id, uWS::MoveOnlyFunction<void()> &&task) {
+    if (shard_id == current_shard_id_) {
+        task();
     } else {
-        RunnerWebSocket *ws = runners_waiting_.extract(runners_waiting_.begin()).value();
-        workflow_ptr->RunBlock(block_id, ws);
+        shards_[shard_id].loop->defer(std::move(task));
     }
 }
 
+void Scheduler::PostDelayed(size_t shard_id, int delay_ms,
+                            uWS::MoveOnlyFunction<void()> &&task) {
+    using Task = uWS::MoveOnlyFunction<void()>;
+    Post(shard_id, [this, shard_id, delay_ms, task = std::move(task)]() mutable {
+        auto *loop = reinterpret_cast<us_loop_t *>(shards_[shard_id].loop);
+        us_timer_t *timer = us_create_timer(loop, 0, sizeof(Task *));
+        *static_cast<Task **>(us_timer_ext(timer)) = new Task(std::move(task));
+        us_timer_set(
+            timer,
+            [](us_timer_t *timer) {
+                Task *task = *static_cast<Task **>(us_timer_ext(timer));
+                us_timer_close(timer);
+                (*task)();
+                delete task;
+            },
+            std::max(delay_ms, 1), 0);
+    });
+}
+
+uint64_t Scheduler::NewSocketId() {
+    return cnt_sockets_++;
+}
+
 void Scheduler::JoinRunner(RunnerWebSocket *ws) {
-    std::string partition = ws->getUserData()->partition;
-    groups_[partition].AddRunner(ws);
+    auto *data = ws->getUserData();
+    data->socket_id = NewSocketId();
+    shards_[current_shard_id_].runner_sockets[data->socket_id] = ws;
+    SocketRef socket = {.shard_id = current_shard_id_, .socket_id = data->socket_id};
+    size_t shard_id = GetShardId(data->partition);
+    Post(shard_id, [this, shard_id, socket, partition = data->partition,
+                    runner_id = data->runner_id, node = data->node, capacity = data->capacity,
+                    wire_version = data->wire_version] {
+        shards_[shard_id].groups[partition].AddRunner(socket, runner_id, node, capacity,
+                                                      wire_version);
+    });
 }
 
 void Scheduler::LeaveRunner(RunnerWebSocket *ws) {
-    std::string partition = ws->getUserData()->partition;
-    groups_[partition].RemoveRunner(ws);
+    auto *data = ws->getUserData();
+    shards_[current_shard_id_].runner_sockets.erase(data->socket_id);
+    SocketRef socket = {.shard_id = current_shard_id_, .socket_id = data->socket_id};
+    size_t shard_id = GetShardId(data->partition);
+    Post(shard_id, [this, shard_id, socket, partition = data->partition] {
+        shards_[shard_id].groups[partition].RemoveRunner(socket);
+    });
+}
+
+void Scheduler::OnStatus(RunnerWebSocket *ws, std::string_view message) {
+    auto *data = ws->getUserData();
+    RunResponse run_response;
+    try {
+        if (IsWireMessage(message)) {
+            DecodeMessage(run_response, message);
+        } else {
+            FromJSON(run_response, message);
+        }
+    } catch (const ParseError &error) {
+        LogWarning("Runner ", data->runner_id, ": dropped message, ", error.message);
+        return;
+    }
+    SocketRef socket = {.shard_id = current_shard_id_, .socket_id = data->socket_id};
+    size_t shard_id = GetShardId(data->partition);
+    Post(shard_id, [this, shard_id, socket, partition = data->partition,
+                    run_response = std::move(run_response)] {
+        shards_[shard_id].groups[partition].OnStatus(socket, run_response);
+    });
 }
 
 void Scheduler::JoinClient(ClientWebSocket *ws) {
-    ws->getUserData()->workflow_ptr->AddClient(ws);
+    auto *data = ws->getUserData();
+    data->socket_id = NewSocketId();
+    shards_[current_shard_id_].client_sockets[data->socket_id] = ws;
+    SocketRef client = {.shard_id = current_shard_id_, .socket_id = data->socket_id};
+    Post(data->owner_id, [this, client, owner_id = data->owner_id,
+                          workflow_id = data->workflow_id, after = data->after] {
+        if (WorkflowState *workflow_ptr = FindWorkflow(owner_id, workflow_id)) {
+            workflow_ptr->AddClient(client, after);
+            TouchWorkflow(workflow_ptr);
+            return;
+        }
+        // Clients of an archived workflow get the final states of its blocks, resuming ones
+        // together with the end of the run they were waiting for.
+        auto &archive = shards_[owner_id].archive;
+        auto iter = archive.find(workflow_id);
+        if (iter == archive.end()) {
+            return;
+        }
+        if (after.has_value()) {
+            ClientSnapshot snapshot = {.seq = 0, .running = false, .blocks = iter->second.blocks};
+            SendToClient(client, std::string(ToJSON(snapshot, SNAPSHOT_SIGNAL " ")));
+            return;
+        }
+        for (const auto &block_response : iter->second.blocks) {
+            SendToClient(client, std::string(ToJSON(block_response, BLOCK_SIGNAL " ")));
+        }
+    });
 }
 
 void Scheduler::LeaveClient(ClientWebSocket *ws) {
-    ws->getUserData()->workflow_ptr->RemoveClient(ws);
+    auto *data = ws->getUserData();
+    shards_[current_shard_id_].client_sockets.erase(data->socket_id);
+    SocketRef client = {.shard_id = current_shard_id_, .socket_id = data->socket_id};
+    Post(data->owner_id,
+         [this, client, owner_id = data->owner_id, workflow_id = data->workflow_id] {
+             if (WorkflowState *workflow_ptr = FindWorkflow(owner_id, workflow_id)) {
+                 workflow_ptr->RemoveClient(client);
+             }
+         });
 }
 
-std::string Scheduler::AddWorkflow(const rapidjson::Document &document) {
-    std::string workflow_id = GenerateUuid();
-    WorkflowState workflow_state;
-    workflow_state.Init(document);
-    workflow_state.workflow_id = workflow_id;
-    workflow_state.partition_ptr = &groups_[workflow_state.meta.partition];
-    workflows_[workflow_id] = std::move(workflow_state);
+void Scheduler::OnSignal(ClientWebSocket *ws, std::string_view message) {
+    auto *data = ws->getUserData();
+    SocketRef client = {.shard_id = current_shard_id_, .socket_id = data->socket_id};
+    Post(data->owner_id, [this, client, owner_id = data->owner_id, workflow_id = data->workflow_id,
+                          signal = std::string(message)] {
+        WorkflowState *workflow_ptr = FindWorkflow(owner_id, workflow_id);
+        try {
+            if (!workflow_ptr) {
+                throw RuntimeError(ARCHIVED_ERROR);
+            }
+            if (signal == RUN_SIGNAL) {
+                workflow_ptr->Run();
+            } else if (signal == STOP_SIGNAL) {
+                workflow_ptr->Stop();
+            } else {
+                throw RuntimeError(UNDEFINED_COMMAND_ERROR);
+            }
+            TouchWorkflow(workflow_ptr);
+        } catch (const RuntimeError &error) {
+            SendToClient(client, ERROR_SIGNAL + std::string(" ") + error.message);
+            Log("Workflow ", workflow_id, ": runtime error '", error.message, "'");
+        }
+    });
+}
+
+void Scheduler::SendToRunner(const SocketRef &socket, std::string message) {
+    Post(socket.shard_id, [this, socket, message = std::move(message)] {
+        auto &runner_sockets = shards_[socket.shard_id].runner_sockets;
+        auto iter = runner_sockets.find(socket.socket_id);
+        if (iter != runner_sockets.end()) {
+            iter->second->send(message);
+        }
+    });
+}
+
+void Scheduler::PublishToClients(size_t shard_id, const std::string &workflow_id,
+                                 std::shared_ptr<const std::string> message) {
+    Post(shard_id, [this, shard_id, topic = GetClientTopic(workflow_id),
+                    message = std::move(message)] {
+        shards_[shard_id].app->publish(topic, *message, uWS::OpCode::TEXT);
+    });
+}
+
+void Scheduler::SubscribeClient(const SocketRef &socket, const std::string &workflow_id,
+                                std::vector<std::shared_ptr<const std::string>> replay) {
+    // The socket subscribes on the same task that replays the events it missed, so that every
+    // event published after the replay was taken reaches it, and none of them before the replay.
+    Post(socket.shard_id,
+         [this, socket, topic = GetClientTopic(workflow_id), replay = std::move(replay)] {
+             auto &client_sockets = shards_[socket.shard_id].client_sockets;
+             auto iter = client_sockets.find(socket.socket_id);
+             if (iter == client_sockets.end()) {
+                 return;
+             }
+             for (const auto &message : replay) {
+                 iter->second->send(*message, uWS::OpCode::TEXT);
+             }
+             iter->second->subscribe(topic);
+         });
+}
+
+std::string Scheduler::GetClientTopic(const std::string &workflow_id) {
+    return "workflow/" + workflow_id;
+}
+
+void Scheduler::SendToClient(const SocketRef &socket, std::string message) {
+    Post(socket.shard_id, [this, socket, message = std::move(message)] {
+        auto &client_sockets = shards_[socket.shard_id].client_sockets;
+        auto iter = client_sockets.find(socket.socket_id);
+        if (iter != client_sockets.end()) {
+            iter->second->send(message, uWS::OpCode::TEXT);
+        }
+    });
+}
+
+std::string Scheduler::AddWorkflow(const rapidjson::Value &document, size_t definition_size) {
+    std::vector<WorkflowState> workflows;
+    workflows.push_back(NewWorkflow(document, definition_size));
+    std::string workflow_id = workflows.back().workflow_id;
+    AddWorkflows(std::move(workflows));
     return workflow_id;
 }
 
-WorkflowState *Scheduler::FindWorkflow(const std::string &workflow_id) {
-    auto iter = workflows_.find(workflow_id);
-    if (iter == workflows_.end()) {
+WorkflowState Scheduler::NewWorkflow(const rapidjson::Value &document, size_t definition_size) {
+    WorkflowState workflow_state;
+    workflow_state.Init(document, definition_size);
+    workflow_state.workflow_id = GenerateUuid();
+    workflow_state.scheduler_ptr = this;
+    return workflow_state;
+}
+
+std::string Substitute(const std::string &text,
+                       const std::unordered_map<std::string, std::string> &params) {
+    // Every ${name} is replaced by the value of the parameter, and $${ stands for a literal ${.
+    std::string result;
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t begin = text.find('$', position);
+        if (begin == std::string::npos) {
+            break;
+        }
+        result.append(text, position, begin - position);
+        if (text.compare(begin, 3, "$${") == 0) {
+            result.append("${");
+            position = begin + 3;
+        } else if (text.compare(begin, 2, "${") == 0) {
+            size_t end = text.find('}', begin);
+            auto iter = end == std::string::npos
+                            ? params.end()
+                            : params.find(text.substr(begin + 2, end - begin - 2));
+            if (iter == params.end()) {
+                throw ValidationError(UNDEFINED_PARAMETER_ERROR);
+            }
+            result.append(iter->second);
+            position = end + 1;
+        } else {
+            result.push_back('$');
+            position = begin + 1;
+        }
+    }
+    result.append(text, position);
+    return result;
+}
+
+WorkflowState Scheduler::NewWorkflow(const WorkflowTemplate &workflow_template,
+                                     const std::unordered_map<std::string, std::string> &params) {
+    // Parameters only reach argv, env and the outside paths of binds, so the graph and its
+    // validation are taken from the template as they are.
+    Workflow workflow = workflow_template.workflow;
+    for (auto &block : workflow.blocks) {
+        for (auto &arg : block.argv) {
+            arg = Substitute(arg, params);
+        }
+        for (auto &variable : block.env) {
+            variable = Substitute(variable, params);
+        }
+        for (auto &bind : block.binds) {
+            bind.outside = Substitute(bind.outside, params);
+        }
+    }
+    WorkflowState workflow_state;
+    workflow_state.Init(std::move(workflow), workflow_template.graph,
+                        workflow_template.definition_size);
+    workflow_state.workflow_id = GenerateUuid();
+    workflow_state.scheduler_ptr = this;
+    return workflow_state;
+}
+
+void Scheduler::AddWorkflows(std::vector<WorkflowState> workflows) {
+    // A batch takes the lock once and wakes up every shard at most once, however many workflows
+    // it carries.
+    std::vector<std::vector<WorkflowState>> shard_workflows(shards_.size());
+    {
+        std::lock_guard lock(workflow_shards_mutex_);
+        for (auto &workflow_state : workflows) {
+            size_t shard_id = GetShardId(workflow_state.meta.partition);
+            workflow_shards_[workflow_state.workflow_id] = shard_id;
+            shard_workflows[shard_id].push_back(std::move(workflow_state));
+        }
+    }
+    for (size_t shard_id = 0; shard_id < shards_.size(); ++shard_id) {
+        if (shard_workflows[shard_id].empty()) {
+            continue;
+        }
+        Post(shard_id, [this, shard_id,
+                        workflows = std::move(shard_workflows[shard_id])]() mutable {
+            auto &shard = shards_[shard_id];
+            for (auto &workflow_state : workflows) {
+                workflow_state.partition_ptr = &shard.groups[workflow_state.meta.partition];
+                std::string workflow_id = workflow_state.workflow_id;
+                Workflow workflow = workflow_state;
+                shard.memory_usage += workflow_state.GetMemoryUsage();
+                shard.workflows[workflow_id] = std::move(workflow_state);
+                AppendEvent(shard_id, {.type = SUBMIT_EVENT,
+                                       .workflow_id = workflow_id,
+                                       .workflow = std::move(workflow)});
+                TouchWorkflow(&shard.workflows[workflow_id]);
+            }
+            EvictWorkflows(shard_id);
+        });
+    }
+}
+
+std::string Scheduler::AddTemplate(const rapidjson::Value &document) {
+    // Templates never change, so they are kept as plain files apart from the journal.
+    auto workflow_template = std::make_shared<WorkflowTemplate>();
+    Deserialize(workflow_template->workflow, document);
+    // Paths inside the container shape the graph, which is validated once for all instances.
+    std::vector<const std::string *> paths;
+    for (const auto &block : workflow_template->workflow.blocks) {
+        for (const auto &input : block.inputs) {
+            paths.push_back(&input.path);
+        }
+        for (const auto &output : block.outputs) {
+            paths.push_back(&output.path);
+        }
+        for (const auto &bind : block.binds) {
+            paths.push_back(&bind.inside);
+        }
+    }
+    for (const auto *path : paths) {
+        if (path->find("${") != std::string::npos) {
+            throw ValidationError(MISPLACED_PARAMETER_ERROR);
+        }
+    }
+    workflow_template->graph = WorkflowState::BuildGraph(workflow_template->workflow);
+    std::string template_text = StringifyJSON(document);
+    workflow_template->definition_size = template_text.size();
+    std::string template_id = GenerateUuid();
+    fs::path template_path = fs::path(TEMPLATES_DIR) / (template_id + ".json");
+    fs::create_directories(TEMPLATES_DIR);
+    {
+        std::ofstream template_file(template_path.string() + ".tmp", std::ios::trunc);
+        template_file << template_text;
+    }
+    fs::rename(template_path.string() + ".tmp", template_path);
+    std::lock_guard lock(templates_mutex_);
+    CacheTemplate(template_id, std::move(workflow_template));
+    return template_id;
+}
+
+std::shared_ptr<const WorkflowTemplate> Scheduler::FindTemplate(const std::string &template_id) {
+    // Only the recently used templates are kept in memory, the others are read from their files
+    // again when needed.
+    std::lock_guard lock(templates_mutex_);
+    auto iter = templates_.find(template_id);
+    if (iter != templates_.end()) {
+        templates_order_.splice(templates_order_.end(), templates_order_, iter->second.position);
+        return iter->second.workflow_template;
+    }
+    auto workflow_template = LoadTemplate(template_id);
+    if (workflow_template) {
+        CacheTemplate(template_id, workflow_template);
+    }
+    return workflow_template;
+}
+
+std::optional<size_t> Scheduler::FindWorkflowShard(const std::string &workflow_id) {
+    std::lock_guard lock(workflow_shards_mutex_);
+    auto iter = workflow_shards_.find(workflow_id);
+    if (iter == workflow_shards_.end()) {
+        return std::nullopt;
+    } else {
+        return iter->second;
+    }
+}
+
+WorkflowState *Scheduler::FindWorkflow(size_t shard_id, const std::string &workflow_id) {
+    auto &workflows = shards_[shard_id].workflows;
+    auto iter = workflows.find(workflow_id);
+    if (iter == workflows.end()) {
         return nullptr;
     } else {
         return &iter->second;
     }
 }
+
+void Scheduler::AppendEvent(size_t shard_id, const JournalEvent &event) {
+    auto &shard = shards_[shard_id];
+    if (!shard.journal.has_value()) {
+        return;
+    }
+    shard.journal->Append(event);
+    if (shard.journal->CountEvents() >= Config::Get().scheduler_snapshot_interval &&
+        !shard.snapshot_pending) {
+        shard.snapshot_pending = true;
+        shard.loop->defer([this, shard_id] { WriteSnapshot(shard_id); });
+    }
+}
+
+void Scheduler::Recover() {
+    // Runs before the event loops start. Workflows are rebuilt from the journal of the last
+    // epoch and placed on the shards of the current configuration, then a new epoch begins with
+    // a snapshot of every shard.
+    size_t epoch = Journal::ReadEpoch(JOURNAL_DIR);
+    std::vector<ShardSnapshot> snapshots;
+    std::vector<std::vector<JournalEvent>> events;
+    Journal::ReadEpochShards(JOURNAL_DIR, epoch, snapshots, events);
+    std::unordered_map<std::string, WorkflowState *> workflows;
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+        for (auto &archived : snapshots[i].archived) {
+            size_t shard_id = GetShardId(archived.partition);
+            RegisterWorkflow(archived.workflow_id, shard_id);
+            StoreArchived(shard_id, std::move(archived));
+        }
+        for (const auto &snapshot : snapshots[i].workflows) {
+            WorkflowState &workflow_state =
+                PlaceWorkflow(snapshot.workflow_id, snapshot.workflow.meta.partition);
+            workflow_state.Load(snapshot);
+            shards_[GetShardId(workflow_state.meta.partition)].memory_usage +=
+                workflow_state.GetMemoryUsage();
+            workflows[snapshot.workflow_id] = &workflow_state;
+        }
+        for (const auto &event : events[i]) {
+            if (event.type == EXPIRE_EVENT) {
+                if (auto shard_id = FindWorkflowShard(event.workflow_id)) {
+                    ExpireWorkflow(shard_id.value(), event.workflow_id);
+                }
+                continue;
+            }
+            if (event.type == SUBMIT_EVENT) {
+                WorkflowState &workflow_state =
+                    PlaceWorkflow(event.workflow_id, event.workflow->meta.partition);
+                auto document = Serialize(event.workflow.value());
+                workflow_state.Init(document, StringifyJSON(document).size());
+                shards_[GetShardId(workflow_state.meta.partition)].memory_usage +=
+                    workflow_state.GetMemoryUsage();
+                workflows[event.workflow_id] = &workflow_state;
+            }
+            auto iter = workflows.find(event.workflow_id);
+            if (iter == workflows.end()) {
+                continue;
+            }
+            if (event.type == ARCHIVE_EVENT) {
+                ArchiveWorkflow(GetShardId(iter->second->meta.partition), event.workflow_id);
+                workflows.erase(iter);
+            } else {
+                iter->second->Replay(event);
+            }
+        }
+    }
+    for (auto &[workflow_id, workflow_ptr] : workflows) {
+        workflow_ptr->Resume();
+        TouchWorkflow(workflow_ptr);
+    }
+    for (size_t shard_id = 0; shard_id < shards_.size(); ++shard_id) {
+        shards_[shard_id].journal.emplace(JOURNAL_DIR, epoch + 1, shard_id);
+        WriteSnapshot(shard_id);
+    }
+    Journal::WriteEpoch(JOURNAL_DIR, epoch + 1);
+    Journal::RemoveOtherEpochs(JOURNAL_DIR, epoch + 1);
+    Log("Recovered ", workflows.size(), " workflows");
+}
+
+WorkflowState &Scheduler::PlaceWorkflow(const std::string &workflow_id,
+                                        const std::string &partition) {
+    size_t shard_id = GetShardId(partition);
+    RegisterWorkflow(workflow_id, shard_id);
+    auto &shard = shards_[shard_id];
+    WorkflowState &workflow_state = shard.workflows[workflow_id];
+    workflow_state.workflow_id = workflow_id;
+    workflow_state.scheduler_ptr = this;
+    workflow_state.partition_ptr = &shard.groups[partition];
+    return workflow_state;
+}
+
+void Scheduler::RegisterWorkflow(const std::string &workflow_id, size_t shard_id) {
+    std::lock_guard lock(workflow_shards_mutex_);
+    workflow_shards_[workflow_id] = shard_id;
+}
+
+std::shared_ptr<const WorkflowTemplate> Scheduler::LoadTemplate(const std::string &template_id) {
+    // Identifiers come from the request path, so anything but a generated one is not looked up.
+    if (template_id.empty() ||
+        template_id.find_first_not_of("0123456789abcdef-") != std::string::npos) {
+        return nullptr;
+    }
+    fs::path template_path = fs::path(TEMPLATES_DIR) / (template_id + ".json");
+    std::error_code error;
+    size_t definition_size = fs::file_size(template_path, error);
+    if (error) {
+        return nullptr;
+    }
+    auto document = ReadJSON(template_path.string());
+    if (document.HasParseError()) {
+        LogWarning("Template ", template_id, ": unreadable, ", FormattedError(document));
+        return nullptr;
+    }
+    auto workflow_template = std::make_shared<WorkflowTemplate>();
+    Deserialize(workflow_template->workflow, document);
+    workflow_template->graph = WorkflowState::BuildGraph(workflow_template->workflow);
+    workflow_template->definition_size = definition_size;
+    return workflow_template;
+}
+
+void Scheduler::CacheTemplate(const std::string &template_id,
+                              std::shared_ptr<const WorkflowTemplate> workflow_template) {
+    templates_order_.push_back(template_id);
+    templates_[template_id] = {.workflow_template = std::move(workflow_template),
+                               .position = std::prev(templates_order_.end())};
+    size_t max_templates = std::max(Config::Get().scheduler_max_templates, 1);
+    while (templates_.size() > max_templates) {
+        templates_.erase(templates_order_.front());
+        templates_order_.pop_front();
+    }
+}
+
+void Scheduler::WriteSnapshot(size_t shard_id) {
+    auto &shard = shards_[shard_id];
+    shard.snapshot_pending = false;
+    std::vector<WorkflowSnapshot> workflows;
+    for (const auto &[workflow_id, workflow_state] : shard.workflows) {
+        workflows.push_back(workflow_state.Save());
+    }
+    std::vector<ArchivedWorkflow> archived;
+    for (const auto &[workflow_id, archived_workflow] : shard.archive) {
+        archived.push_back(archived_workflow);
+    }
+    shard.journal->WriteSnapshot(std::move(workflows), std::move(archived));
+}
+
+void Scheduler::TouchWorkflow(WorkflowState *workflow_ptr) {
+    auto &shard = shards_[GetShardId(workflow_ptr->meta.partition)];
+    auto iter = shard.idle_positions.find(workflow_ptr->workflow_id);
+    if (iter != shard.idle_positions.end()) {
+        shard.idle_workflows.erase(iter->second);
+        shard.idle_positions.erase(iter);
+    }
+    if (!workflow_ptr->IsRunning()) {
+        shard.idle_workflows.push_back({.workflow_id = workflow_ptr->workflow_id,
+                                        .idle_since = std::chrono::steady_clock::now()});
+        shard.idle_positions[workflow_ptr->workflow_id] = std::prev(shard.idle_workflows.end());
+    }
+}
+
+void Scheduler::ArchiveWorkflow(size_t shard_id, const std::string &workflow_id) {
+    auto &shard = shards_[shard_id];
+    auto iter = shard.workflows.find(workflow_id);
+    StoreArchived(shard_id, iter->second.Archive());
+    shard.memory_usage -= iter->second.GetMemoryUsage();
+    auto position_iter = shard.idle_positions.find(workflow_id);
+    if (position_iter != shard.idle_positions.end()) {
+        shard.idle_workflows.erase(position_iter->second);
+        shard.idle_positions.erase(position_iter);
+    }
+    shard.workflows.erase(iter);
+    AppendEvent(shard_id, {.type = ARCHIVE_EVENT, .workflow_id = workflow_id});
+    Log("Workflow ", workflow_id, ": archived");
+}
+
+void Scheduler::StoreArchived(size_t shard_id, ArchivedWorkflow archived) {
+    auto &shard = shards_[shard_id];
+    std::string workflow_id = archived.workflow_id;
+    shard.memory_usage += GetMemoryUsage(archived);
+    shard.archive[workflow_id] = std::move(archived);
+    shard.archive_order.push_back(
+        {.workflow_id = workflow_id, .idle_since = std::chrono::steady_clock::now()});
+    shard.archive_positions[workflow_id] = std::prev(shard.archive_order.end());
+}
+
+void Scheduler::ExpireWorkflow(size_t shard_id, const std::string &workflow_id) {
+    auto &shard = shards_[shard_id];
+    auto iter = shard.archive.find(workflow_id);
+    if (iter == shard.archive.end()) {
+        return;
+    }
+    shard.memory_usage -= GetMemoryUsage(iter->second);
+    shard.archive.erase(iter);
+    auto position_iter = shard.archive_positions.find(workflow_id);
+    shard.archive_order.erase(position_iter->second);
+    shard.archive_positions.erase(position_iter);
+    {
+        std::lock_guard lock(workflow_shards_mutex_);
+        workflow_shards_.erase(workflow_id);
+    }
+    AppendEvent(shard_id, {.type = EXPIRE_EVENT, .workflow_id = workflow_id});
+    Log("Workflow ", workflow_id, ": expired");
+}
+
+void Scheduler::EvictWorkflows(size_t shard_id) {
+    // Idle workflows are archived in LRU order once they outlive the TTL, and also while the
+    // shard holds more workflows or memory than its share of the limits. Running workflows are
+    // never archived, so the limits may be exceeded while they run. Archived workflows are then
+    // forgotten in the order they were archived, once they outlive the TTL again or while the
+    // shard is still over its memory budget.
+    auto &shard = shards_[shard_id];
+    auto idle_deadline = std::chrono::steady_clock::now() -
+                         std::chrono::seconds(Config::Get().scheduler_workflow_ttl_s);
+    size_t max_workflows =
+        std::max<size_t>(Config::Get().scheduler_max_workflows / shards_.size(), 1);
+    // The result cache is shared by the shards and takes its part of the budget from each.
+    size_t memory_budget =
+        (static_cast<size_t>(Config::Get().scheduler_memory_budget_mb) << 20) / shards_.size();
+    memory_budget -= std::min(ResultCache::Get().GetMemoryUsage() / shards_.size(), memory_budget);
+    while (!shard.idle_workflows.empty()) {
+        if (shard.idle_workflows.front().idle_since > idle_deadline &&
+            shard.workflows.size() <= max_workflows && shard.memory_usage <= memory_budget) {
+            break;
+        }
+        std::string workflow_id = shard.idle_workflows.front().workflow_id;
+        ArchiveWorkflow(shard_id, workflow_id);
+    }
+    while (!shard.archive_order.empty()) {
+        if (shard.archive_order.front().idle_since > idle_deadline &&
+            shard.memory_usage <= memory_budget) {
+            break;
+        }
+        std::string workflow_id = shard.archive_order.front().workflow_id;
+        ExpireWorkflow(shard_id, workflow_id);
+    }
+}
+
+void Scheduler::ScheduleEviction(size_t shard_id) {
+    PostDelayed(shard_id, kEvictionIntervalMs, [this, shard_id] {
+        EvictWorkflows(shard_id);
+        ScheduleEviction(shard_id);
+    });
+}
+
+void Scheduler::ScheduleSpeculation(size_t shard_id) {
+    PostDelayed(shard_id, kSpeculationIntervalMs, [this, shard_id] {
+        for (auto &[partition, group] : shards_[shard_id].groups) {
+            group.Speculate();
+        }
+        ScheduleSpeculation(shard_id);
+    });
+}
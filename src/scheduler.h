@@ -1,7 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
+#include <set>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -11,20 +20,74 @@
 #include <rapidjson/document.h>
 #include <App.h>
 
+#include "archived_workflow.h"
+#include "block_response.h"
+#include "block_state.h"
+#include "client_snapshot.h"
+#include "journal.h"
+#include "resources.h"
+#include "run_request.h"
+#include "run_response.h"
 #include "workflow.h"
 
 class WorkflowState;
 class Partition;
+class Scheduler;
+
+struct SocketRef {
+    size_t shard_id;
+    uint64_t socket_id;
+};
+
+struct RunnerTask {
+    WorkflowState *workflow_ptr;
+    size_t block_id;
+    Resources demand;
+    std::chrono::steady_clock::time_point start_time;
+    bool speculative = false;
+};
+
+struct RunnerState {
+    int runner_id;
+    std::string node;
+    int wire_version;
+    SocketRef socket;
+    Resources capacity, usage;
+    std::unordered_map<size_t, RunnerTask> tasks;
+};
 
 struct RunnerPerSocketData {
     std::string partition;
     int runner_id;
-    WorkflowState *workflow_ptr;
-    size_t block_id;
+    std::string node;
+    Resources capacity;
+    int wire_version;
+    uint64_t socket_id;
 };
 
 struct ClientPerSocketData {
-    WorkflowState *workflow_ptr;
+    std::string workflow_id;
+    size_t owner_id;
+    std::optional<size_t> after;
+    uint64_t socket_id;
+};
+
+// Structure of a workflow derived from its connections. It does not depend on argv, env or binds,
+// so all instances of a template share one.
+struct WorkflowGraph {
+    std::vector<std::vector<Connection>> go;
+    std::vector<size_t> component;
+    std::vector<std::vector<size_t>> components;
+    // Components with a connection into each component.
+    std::vector<std::vector<size_t>> upstream;
+    std::vector<std::optional<size_t>> stream_source;
+    std::vector<std::vector<size_t>> stream_peers;
+};
+
+struct WorkflowTemplate {
+    Workflow workflow;
+    std::shared_ptr<const WorkflowGraph> graph;
+    size_t definition_size;
 };
 
 using RunnerWebSocket = uWS::WebSocket<false, true, RunnerPerSocketData>;
@@ -34,72 +97,259 @@ class WorkflowState : public Workflow {
 public:
     std::string workflow_id;
     Partition *partition_ptr;
+    Scheduler *scheduler_ptr;
 
     WorkflowState() = default;
 
-    void Init(const rapidjson::Document &document);
+    void Init(const rapidjson::Value &document, size_t definition_size);
+    void Init(Workflow workflow, std::shared_ptr<const WorkflowGraph> graph,
+              size_t definition_size);
+    static std::shared_ptr<const WorkflowGraph> BuildGraph(const Workflow &workflow);
+
+    bool IsRunning() const;
+    size_t GetMemoryUsage() const;
+    ArchivedWorkflow Archive() const;
 
     void Run();
     void Stop();
 
-    void RunBlock(size_t block_id, RunnerWebSocket *ws);
-    void OnStatus(RunnerWebSocket *ws, std::string_view message);
+    WorkflowSnapshot Save() const;
+    void Load(const WorkflowSnapshot &snapshot);
+    void Replay(const JournalEvent &event);
+    void Resume();
+
+    void RunBlock(size_t block_id, size_t task_id, const RunnerState &runner);
+    bool RunSpeculativeCopy(size_t block_id, size_t task_id, const RunnerState &runner);
+    void ResolveSpeculation(size_t block_id, bool keep_copy);
+    bool CanSpeculate(size_t block_id) const;
+    std::optional<int64_t> GetExpectedWallTimeMs(size_t block_id) const;
+    void SetWallTime(size_t block_id, int64_t wall_time_ms);
+    void OnStatus(size_t block_id, const RunResponse &run_response);
+    void OnRunnerLost(size_t block_id);
 
     void EnqueueBlock(size_t block_id);
-    void DequeueBlock();
+    void DequeueBlock(size_t block_id);
     void UpdateBlocksProcessing();
 
+    void PropagateOutputs(size_t block_id);
+    void SkipBlock(size_t block_id);
+    bool IsBlockUpToDate(size_t block_id) const;
     bool ProcessConnection(const Connection &connection);
     bool IsBlockReady(size_t block_id) const;
+    std::string GetPreferredNode(size_t block_id) const;
+    std::optional<std::string> GetRequiredNode(size_t block_id) const;
+
+    void ConnectStreams(size_t block_id);
+    void CancelStreamPeers(size_t block_id);
+
+    static void FindComponents(WorkflowGraph &graph);
+    void UpdatePriorities();
+    void UpdatePriorities(size_t block_id);
+    int64_t GetComponentPriority(size_t component_id) const;
+    void ReorderReadyBlocks();
 
     void PrepareRun(size_t block_id);
     void FinalizeRun(size_t block_id);
 
-    void SendRunRequest(size_t block_id, RunnerWebSocket *ws);
+    void SendRunRequest(size_t block_id, size_t task_id, const RunnerState &runner,
+                        const std::string &container_path);
 
-    void AddClient(ClientWebSocket *ws);
-    void RemoveClient(ClientWebSocket *ws);
+    void AddClient(const SocketRef &client, std::optional<size_t> after);
+    void RemoveClient(const SocketRef &client);
     void SendToAllClients(std::string_view message);
+    void SendBlockResponse(const BlockResponse &response);
+    void FlushBlockResponses();
+    ClientSnapshot GetClientSnapshot() const;
 
 private:
-    struct BlockState {
-        size_t cnt_runs = 0;
-        size_t cnt_inputs_ready = 0;
-        std::vector<std::optional<std::string>> input_sources;
+    struct ReadyBlock {
+        int64_t priority;
+        size_t order;
+        size_t block_id;
+
+        bool operator<(const ReadyBlock &other) const {
+            if (priority != other.priority) {
+                return priority < other.priority;
+            }
+            return order > other.order;
+        }
     };
 
     bool is_running_ = false;
-    size_t cnt_blocks_processing_ = 0;
-    std::queue<size_t> blocks_ready_;
+    bool is_stopping_ = false;
+    bool replaying_ = false;
+    size_t memory_usage_ = 0;
+    size_t cnt_workflow_runs_ = 0;
+    size_t cnt_blocks_enqueued_ = 0;
+    std::priority_queue<ReadyBlock> blocks_ready_;
+    std::vector<size_t> cnt_ready_;
+    std::vector<int64_t> component_priorities_;
+    int64_t default_weight_ = 1;
+    std::unordered_set<size_t> blocks_processing_;
     std::vector<BlockState> blocks_state_;
-    std::vector<std::vector<Connection>> go_;
-    std::unordered_set<ClientWebSocket *> clients_;
+    std::multiset<int64_t> lower_wall_times_ms_, upper_wall_times_ms_;
+    std::shared_ptr<const WorkflowGraph> graph_;
+    std::vector<std::vector<std::string>> run_request_parts_, wire_run_request_parts_;
+    std::unordered_map<uint64_t, SocketRef> clients_;
+    std::unordered_map<size_t, size_t> client_shards_;
+    std::vector<BlockResponse> pending_responses_;
+    // Events sent to clients, numbered from 1 and kept in a ring for clients that reconnect.
+    // Nothing is recorded until a client has joined.
+    bool watched_ = false;
+    size_t cnt_events_ = 0;
+    std::vector<std::shared_ptr<const std::string>> events_;
+    static constexpr int64_t kMaxRetryBackoffMs = 60000;
 
     std::string GetContainerId(size_t block_id, size_t run_id) const;
+    RunRequest BuildRunRequest(size_t block_id) const;
+    std::vector<std::string> BuildRunRequestParts(size_t block_id) const;
+    std::vector<std::string> BuildWireRunRequestParts(size_t block_id) const;
+    std::optional<std::string> GetCacheKey(size_t block_id) const;
+    std::optional<std::string> GetBindsDigest(size_t block_id) const;
+    bool ReuseCachedResult(size_t block_id);
+    void FinishBlock(size_t block_id, const RunResponse &run_response);
+    void AppendEvent(const JournalEvent &event);
 };
 
 class Partition {
 public:
-    void AddRunner(RunnerWebSocket *ws);
-    void RemoveRunner(RunnerWebSocket *ws);
+    void AddRunner(const SocketRef &socket, int runner_id, const std::string &node,
+                   const Resources &capacity, int wire_version);
+    void RemoveRunner(const SocketRef &socket);
     void EnqueueBlock(WorkflowState *workflow_ptr, size_t block_id);
+    void CancelWorkflow(WorkflowState *workflow_ptr);
+    void CancelBlock(WorkflowState *workflow_ptr, size_t block_id);
+    void OnStatus(const SocketRef &socket, const RunResponse &run_response);
+    void Speculate();
 
 private:
-    std::unordered_set<RunnerWebSocket *> runners_waiting_;
-    std::queue<std::pair<WorkflowState *, size_t>> blocks_waiting_;
+    struct WaitingBlock {
+        size_t block_id;
+        std::string node;
+        std::chrono::steady_clock::time_point enqueue_time;
+    };
+
+    struct TaskRef {
+        uint64_t socket_id;
+        size_t task_id;
+    };
+
+    struct WorkflowQueue {
+        std::queue<WaitingBlock> blocks;
+        int deficit = 0;
+    };
+
+    size_t cnt_tasks_ = 0;
+    std::chrono::steady_clock::time_point dispatch_deadline_ =
+        std::chrono::steady_clock::time_point::max();
+    std::unordered_map<uint64_t, RunnerState> runners_;
+    std::unordered_map<WorkflowState *, WorkflowQueue> blocks_waiting_;
+    std::deque<WorkflowState *> workflows_waiting_;
+    std::map<std::pair<WorkflowState *, size_t>, std::pair<TaskRef, TaskRef>> speculations_;
+
+    void Dispatch();
+    void ScheduleDispatch(WorkflowState *workflow_ptr,
+                          std::chrono::steady_clock::time_point deadline);
+    RunnerState *FindRunner(const Resources &demand, const std::string &node = "");
+    RunnerState *FindNodeRunner(const std::string &node);
+    void DequeueBlock(size_t position);
 };
 
+// Every shard is served by its own event loop. Partitions are pinned to a shard together with
+// their workflows, while sockets stay on the loop that accepted them; work crosses between the
+// two through Post.
 class Scheduler {
 public:
+    explicit Scheduler(size_t cnt_shards);
+
+    size_t CountShards() const;
+    size_t GetShardId(const std::string &partition) const;
+    void AttachShard(size_t shard_id, uWS::Loop *loop, uWS::App *app);
+    void Post(size_t shard_id, uWS::MoveOnlyFunction<void()> &&task);
+    void PostDelayed(size_t shard_id, int delay_ms, uWS::MoveOnlyFunction<void()> &&task);
+
+    uint64_t NewSocketId();
+
     void JoinRunner(RunnerWebSocket *ws);
     void LeaveRunner(RunnerWebSocket *ws);
+    void OnStatus(RunnerWebSocket *ws, std::string_view message);
     void JoinClient(ClientWebSocket *ws);
     void LeaveClient(ClientWebSocket *ws);
+    void OnSignal(ClientWebSocket *ws, std::string_view message);
 
-    std::string AddWorkflow(const rapidjson::Document &document);
-    WorkflowState *FindWorkflow(const std::string &workflow_id);
+    void SendToRunner(const SocketRef &socket, std::string message);
+    void SendToClient(const SocketRef &socket, std::string message);
+    void SubscribeClient(const SocketRef &socket, const std::string &workflow_id,
+                         std::vector<std::shared_ptr<const std::string>> replay);
+    void PublishToClients(size_t shard_id, const std::string &workflow_id,
+                          std::shared_ptr<const std::string> message);
+    static std::string GetClientTopic(const std::string &workflow_id);
+
+    std::string AddWorkflow(const rapidjson::Value &document, size_t definition_size);
+    WorkflowState NewWorkflow(const rapidjson::Value &document, size_t definition_size);
+    WorkflowState NewWorkflow(const WorkflowTemplate &workflow_template,
+                              const std::unordered_map<std::string, std::string> &params);
+    void AddWorkflows(std::vector<WorkflowState> workflows);
+
+    std::string AddTemplate(const rapidjson::Value &document);
+    std::shared_ptr<const WorkflowTemplate> FindTemplate(const std::string &template_id);
+    std::optional<size_t> FindWorkflowShard(const std::string &workflow_id);
+
+    WorkflowState *FindWorkflow(size_t shard_id, const std::string &workflow_id);
+    void TouchWorkflow(WorkflowState *workflow_ptr);
+
+    void AppendEvent(size_t shard_id, const JournalEvent &event);
+    void Recover();
 
 private:
-    std::unordered_map<std::string, WorkflowState> workflows_;
-    std::unordered_map<std::string, Partition> groups_;
+    struct IdleWorkflow {
+        std::string workflow_id;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+
+    struct CachedTemplate {
+        std::shared_ptr<const WorkflowTemplate> workflow_template;
+        std::list<std::string>::iterator position;
+    };
+
+    struct Shard {
+        uWS::Loop *loop = nullptr;
+        uWS::App *app = nullptr;
+        std::unordered_map<std::string, WorkflowState> workflows;
+        std::unordered_map<std::string, ArchivedWorkflow> archive;
+        std::list<IdleWorkflow> archive_order;
+        std::unordered_map<std::string, std::list<IdleWorkflow>::iterator> archive_positions;
+        std::list<IdleWorkflow> idle_workflows;
+        std::unordered_map<std::string, std::list<IdleWorkflow>::iterator> idle_positions;
+        size_t memory_usage = 0;
+        std::unordered_map<std::string, Partition> groups;
+        std::unordered_map<uint64_t, RunnerWebSocket *> runner_sockets;
+        std::unordered_map<uint64_t, ClientWebSocket *> client_sockets;
+        std::optional<Journal> journal;
+        bool snapshot_pending = false;
+    };
+
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> cnt_sockets_ = 0;
+    std::mutex workflow_shards_mutex_;
+    std::unordered_map<std::string, size_t> workflow_shards_;
+    std::mutex templates_mutex_;
+    std::list<std::string> templates_order_;
+    std::unordered_map<std::string, CachedTemplate> templates_;
+    inline static thread_local size_t current_shard_id_ = -1;
+    static constexpr int kEvictionIntervalMs = 1000;
+    static constexpr int kSpeculationIntervalMs = 1000;
+
+    void RegisterWorkflow(const std::string &workflow_id, size_t shard_id);
+    std::shared_ptr<const WorkflowTemplate> LoadTemplate(const std::string &template_id);
+    void CacheTemplate(const std::string &template_id,
+                       std::shared_ptr<const WorkflowTemplate> workflow_template);
+    WorkflowState &PlaceWorkflow(const std::string &workflow_id, const std::string &partition);
+    void WriteSnapshot(size_t shard_id);
+    void ArchiveWorkflow(size_t shard_id, const std::string &workflow_id);
+    void StoreArchived(size_t shard_id, ArchivedWorkflow archived);
+    void ExpireWorkflow(size_t shard_id, const std::string &workflow_id);
+    void EvictWorkflows(size_t shard_id);
+    void ScheduleEviction(size_t shard_id);
+    void ScheduleSpeculation(size_t shard_id);
 };
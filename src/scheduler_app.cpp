@@ -1,7 +1,21 @@
+#include <algorithm>
+#include <charconv>
 #include <csignal>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <latch>
+#include <limits>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <App.h>
 
 #include "config.h"
@@ -13,8 +27,11 @@
 #include "scheduler.h"
 #include "scheduler_app.h"
 #include "submit_response.h"
+#include "wire.h"
 
-SchedulerApp::SchedulerApp() : workflow_validator_(SCHEMA_DIR "/workflow.json") {
+SchedulerApp::SchedulerApp()
+    : scheduler_(Config::Get().scheduler_threads > 0 ? Config::Get().scheduler_threads
+                                                     : std::thread::hardware_concurrency()) {
 }
 
 void SchedulerInterruptHandler(int signum) {
@@ -22,45 +39,303 @@ void SchedulerInterruptHandler(int signum) {
     exit(signum);
 }
 
+int ParseWireVersion(std::optional<std::string_view> value) {
+    // The runner offers the newest version of the binary protocol it knows, and the scheduler
+    // settles on the newest one both sides know. Runners offering none are spoken to in JSON.
+    int version = 0;
+    if (value.has_value()) {
+        std::from_chars(value->data(), value->data() + value->size(), version);
+    }
+    return std::clamp(version, 0, kWireVersion);
+}
+
+std::optional<size_t> ParseEventSeq(std::optional<std::string_view> value) {
+    // A client that reconnects passes the number of the last event it has seen.
+    size_t seq = 0;
+    if (!value.has_value() ||
+        std::from_chars(value->data(), value->data() + value->size(), seq).ec != std::errc()) {
+        return std::nullopt;
+    }
+    return seq;
+}
+
+Resources ParseCapacity(std::string_view query) {
+    Resources capacity = {.cpus = 1,
+                          .memory_kb = std::numeric_limits<int64_t>::max(),
+                          .threads = std::numeric_limits<int64_t>::max()};
+    while (!query.empty()) {
+        size_t param_end = std::min(query.find('&'), query.size());
+        std::string_view param = query.substr(0, param_end);
+        query.remove_prefix(std::min(param_end + 1, query.size()));
+        size_t separator = param.find('=');
+        if (separator == std::string_view::npos) {
+            continue;
+        }
+        std::string_view key = param.substr(0, separator), value = param.substr(separator + 1);
+        int64_t number;
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+        if (ec != std::errc() || number <= 0) {
+            continue;
+        }
+        if (key == "cpus") {
+            capacity.cpus = number;
+        } else if (key == "memory-kb") {
+            capacity.memory_kb = number;
+        } else if (key == "threads") {
+            capacity.threads = number;
+        }
+    }
+    return capacity;
+}
+
 void SchedulerApp::Run() {
     Logger::Get().SetName("scheduler");
+    Logger::Get().SetLevel(Config::Get().log_level);
+    Logger::Get().Start();
     signal(SIGINT, SchedulerInterruptHandler);
     signal(SIGTERM, SchedulerInterruptHandler);
-    uWS::App()
-        .post("/submit",
+    scheduler_.Recover();
+    std::latch attached(scheduler_.CountShards());
+    std::vector<std::thread> threads;
+    for (size_t shard_id = 1; shard_id < scheduler_.CountShards(); ++shard_id) {
+        threads.emplace_back(&SchedulerApp::RunLoop, this, shard_id, std::ref(attached));
+    }
+    RunLoop(0, attached);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+template <class Response, class Handler>
+void OnBody(Response *res, size_t max_length, Handler &&handler) {
+    res->onAborted([] {});
+    res->onData([res, max_length, handler = std::forward<Handler>(handler), body = std::string()](
+                    std::string_view chunk, bool is_last) mutable {
+        if (body.size() + chunk.size() > max_length) {
+            res->writeStatus(HTTP_REQUEST_ENTITY_TOO_LARGE)->end("", true);
+            return;
+        }
+        body.append(chunk);
+        if (is_last) {
+            handler(body);
+        }
+    });
+}
+
+std::string SchedulerApp::SubmitBatch(const std::string &batch_text,
+                                      SchemaValidator &workflow_validator) {
+    // The batch is either a JSON array of workflows, parsed as a whole, or NDJSON with one
+    // workflow per line, parsed line by line. Every workflow is accepted or rejected on its own,
+    // and the accepted ones are handed over to the scheduler together.
+    std::vector<rapidjson::Document> documents;
+    std::vector<SubmitResponse> submit_responses;
+    std::vector<const rapidjson::Value *> workflows_json;
+    // Sizes of the definitions as received, the footprint of a workflow is estimated from them.
+    std::vector<size_t> definition_sizes;
+    size_t first = batch_text.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && batch_text[first] == '[') {
+        auto &document = documents.emplace_back(ParseJSON(batch_text));
+        if (document.HasParseError()) {
+            throw ParseError(FormattedError(document));
+        }
+        if (!document.IsArray()) {
+            throw ParseError("expected an array of workflows");
+        }
+        for (const auto &workflow_json : document.GetArray()) {
+            workflows_json.push_back(&workflow_json);
+        }
+        submit_responses.resize(workflows_json.size());
+        definition_sizes.assign(workflows_json.size(),
+                                batch_text.size() / std::max<size_t>(workflows_json.size(), 1));
+    } else {
+        // Documents are stored before any pointer to them is taken, since the vector may grow.
+        size_t line_begin = 0;
+        while (line_begin < batch_text.size()) {
+            size_t line_end = std::min(batch_text.find('\n', line_begin), batch_text.size());
+            std::string line = batch_text.substr(line_begin, line_end - line_begin);
+            line_begin = line_end + 1;
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                documents.push_back(ParseJSON(line));
+                definition_sizes.push_back(line.size());
+            }
+        }
+        submit_responses.resize(documents.size());
+        for (size_t index = 0; index < documents.size(); ++index) {
+            workflows_json.push_back(&documents[index]);
+            if (documents[index].HasParseError()) {
+                submit_responses[index] = {.status = SUBMIT_PARSE_ERROR,
+                                           .data = FormattedError(documents[index])};
+            }
+        }
+    }
+    std::vector<WorkflowState> workflows;
+    size_t cnt_accepted = 0;
+    for (size_t index = 0; index < submit_responses.size(); ++index) {
+        auto &submit_response = submit_responses[index];
+        if (!submit_response.status.empty()) {
+            continue;
+        }
+        try {
+            workflow_validator.Validate(*workflows_json[index]);
+            workflows.push_back(scheduler_.NewWorkflow(*workflows_json[index],
+                                                             definition_sizes[index]));
+            submit_response.status = SUBMIT_ACCEPTED;
+            submit_response.data = workflows.back().workflow_id;
+            ++cnt_accepted;
+        } catch (const ValidationError &error) {
+            submit_response.status = SUBMIT_VALIDATION_ERROR;
+            submit_response.data = error.message;
+        }
+    }
+    scheduler_.AddWorkflows(std::move(workflows));
+    Log("Received batch of ", submit_responses.size(), " workflows, ", cnt_accepted, " accepted");
+    return std::string(ToJSON(submit_responses));
+}
+
+std::vector<SubmitResponse> SchedulerApp::SubmitInstances(const WorkflowTemplate &workflow_template,
+                                                          const rapidjson::Value &params_json) {
+    // Parameters are either one object or an array of them, one workflow per object.
+    std::vector<const rapidjson::Value *> params_list;
+    if (params_json.IsArray()) {
+        for (const auto &params : params_json.GetArray()) {
+            params_list.push_back(&params);
+        }
+    } else {
+        params_list.push_back(&params_json);
+    }
+    std::vector<SubmitResponse> submit_responses(params_list.size());
+    std::vector<WorkflowState> workflows;
+    for (size_t index = 0; index < params_list.size(); ++index) {
+        auto &submit_response = submit_responses[index];
+        try {
+            if (!params_list[index]->IsObject()) {
+                throw ValidationError(INVALID_PARAMETERS_ERROR);
+            }
+            std::unordered_map<std::string, std::string> params;
+            for (const auto &member : params_list[index]->GetObject()) {
+                if (!member.value.IsString()) {
+                    throw ValidationError(INVALID_PARAMETERS_ERROR);
+                }
+                params.emplace(member.name.GetString(), member.value.GetString());
+            }
+            workflows.push_back(scheduler_.NewWorkflow(workflow_template, params));
+            submit_response.status = SUBMIT_ACCEPTED;
+            submit_response.data = workflows.back().workflow_id;
+        } catch (const ValidationError &error) {
+            submit_response.status = SUBMIT_VALIDATION_ERROR;
+            submit_response.data = error.message;
+        }
+    }
+    Log("Instantiated template for ", params_list.size(), " workflows, ", workflows.size(),
+        " accepted");
+    scheduler_.AddWorkflows(std::move(workflows));
+    return submit_responses;
+}
+
+void SchedulerApp::RunLoop(size_t shard_id, std::latch &attached) {
+    // Every loop listens on the same port, the kernel spreads incoming connections between them.
+    SchemaValidator workflow_validator(SCHEMA_DIR "/workflow.json");
+    uWS::App app;
+    scheduler_.AttachShard(shard_id, uWS::Loop::get(), &app);
+    attached.arrive_and_wait();
+    app.post("/submit",
+             [&](auto *res, auto *req) {
+                 OnBody(res, Config::Get().scheduler_max_payload_length,
+                        [&, res](const std::string &workflow_text) {
+                            SubmitResponse submit_response;
+                            try {
+                                auto document = workflow_validator.ParseAndValidate(workflow_text);
+                                std::string workflow_id = scheduler_.AddWorkflow(document,
+                                                                     workflow_text.size());
+                                submit_response.status = SUBMIT_ACCEPTED;
+                                submit_response.data = workflow_id;
+                            } catch (const ParseError &error) {
+                                res->writeStatus(HTTP_BAD_REQUEST);
+                                submit_response.status = SUBMIT_PARSE_ERROR;
+                                submit_response.data = error.message;
+                            } catch (const ValidationError &error) {
+                                res->writeStatus(HTTP_BAD_REQUEST);
+                                submit_response.status = SUBMIT_VALIDATION_ERROR;
+                                submit_response.data = error.message;
+                            }
+                            res->end(ToJSON(submit_response));
+                            Log("Received workflow, status = '", submit_response.status,
+                                "', data = '", submit_response.data, "'");
+                        });
+             })
+        .post("/submit-batch",
+              [&](auto *res, auto *req) {
+                  OnBody(res, Config::Get().scheduler_max_batch_payload_length,
+                         [&, res](const std::string &batch_text) {
+                             try {
+                                 res->end(SubmitBatch(batch_text, workflow_validator));
+                             } catch (const ParseError &error) {
+                                 SubmitResponse submit_response = {.status = SUBMIT_PARSE_ERROR,
+                                                                   .data = error.message};
+                                 res->writeStatus(HTTP_BAD_REQUEST)
+                                     ->end(ToJSON(submit_response));
+                                 Log("Received batch, status = '", submit_response.status,
+                                     "', data = '", submit_response.data, "'");
+                             }
+                         });
+              })
+        .post("/template",
+              [&](auto *res, auto *req) {
+                  OnBody(res, Config::Get().scheduler_max_payload_length,
+                         [&, res](const std::string &template_text) {
+                             SubmitResponse submit_response;
+                             try {
+                                 auto document = workflow_validator.ParseAndValidate(template_text);
+                                 std::string template_id = scheduler_.AddTemplate(document);
+                                 submit_response.status = SUBMIT_ACCEPTED;
+                                 submit_response.data = template_id;
+                             } catch (const ParseError &error) {
+                                 res->writeStatus(HTTP_BAD_REQUEST);
+                                 submit_response.status = SUBMIT_PARSE_ERROR;
+                                 submit_response.data = error.message;
+                             } catch (const ValidationError &error) {
+                                 res->writeStatus(HTTP_BAD_REQUEST);
+                                 submit_response.status = SUBMIT_VALIDATION_ERROR;
+                                 submit_response.data = error.message;
+                             } catch (const fs::filesystem_error &error) {
+                                 res->writeStatus(HTTP_INTERNAL_SERVER_ERROR);
+                                 submit_response.status = SUBMIT_INTERNAL_ERROR;
+                                 submit_response.data = error.what();
+                             }
+                             res->end(ToJSON(submit_response));
+                             Log("Received template, status = '", submit_response.status,
+                                 "', data = '", submit_response.data, "'");
+                         });
+              })
+        .post("/template/:id/submit",
               [&](auto *res, auto *req) {
-                  std::string workflow_text;
-                  res->onAborted([] {});
-                  res->onData([&, res, workflow_text = std::move(workflow_text)](
-                                  std::string_view chunk, bool is_last) mutable {
-                      if (workflow_text.size() + chunk.size() >
-                          Config::Get().scheduler_max_payload_length) {
-                          res->writeStatus(HTTP_REQUEST_ENTITY_TOO_LARGE)->end("", true);
-                          return;
-                      }
-                      workflow_text.append(chunk);
-                      if (!is_last) {
-                          return;
-                      }
-                      SubmitResponse submit_response;
-                      try {
-                          auto document = workflow_validator_.ParseAndValidate(workflow_text);
-                          std::string workflow_id = scheduler_.AddWorkflow(document);
-                          submit_response.status = SUBMIT_ACCEPTED;
-                          submit_response.data = workflow_id;
-                      } catch (const ParseError &error) {
-                          res->writeStatus(HTTP_BAD_REQUEST);
-                          submit_response.status = SUBMIT_PARSE_ERROR;
-                          submit_response.data = error.message;
-                      } catch (const ValidationError &error) {
-                          res->writeStatus(HTTP_BAD_REQUEST);
-                          submit_response.status = SUBMIT_VALIDATION_ERROR;
-                          submit_response.data = error.message;
-                      }
-                      res->end(StringifyJSON(Serialize(submit_response)));
-                      Log("Received workflow, status = '", submit_response.status, "', data = '",
-                          submit_response.data, "'");
-                  });
+                  auto workflow_template =
+                      scheduler_.FindTemplate(std::string(req->getParameter("id")));
+                  if (!workflow_template) {
+                      res->writeStatus(HTTP_NOT_FOUND)->end();
+                      return;
+                  }
+                  OnBody(res, Config::Get().scheduler_max_batch_payload_length,
+                         [&, res, workflow_template](const std::string &params_text) {
+                             auto document = ParseJSON(params_text);
+                             if (document.HasParseError()) {
+                                 SubmitResponse submit_response = {
+                                     .status = SUBMIT_PARSE_ERROR,
+                                     .data = FormattedError(document)};
+                                 res->writeStatus(HTTP_BAD_REQUEST)
+                                     ->end(ToJSON(submit_response));
+                                 return;
+                             }
+                             auto submit_responses = SubmitInstances(*workflow_template, document);
+                             if (document.IsArray()) {
+                                 res->end(ToJSON(submit_responses));
+                                 return;
+                             }
+                             if (submit_responses[0].status != SUBMIT_ACCEPTED) {
+                                 res->writeStatus(HTTP_BAD_REQUEST);
+                             }
+                             res->end(ToJSON(submit_responses[0]));
+                         });
               })
         .ws<RunnerPerSocketData>(
             "/runner/:partition/:id",
@@ -71,7 +346,12 @@ void SchedulerApp::Run() {
                      std::string partition(req->getParameter("partition"));
                      int runner_id = std::stoi(std::string(req->getParameter("id")));
                      res->template upgrade<RunnerPerSocketData>(
-                         {.partition = partition, .runner_id = runner_id},
+                         {.partition = partition,
+                          .runner_id = runner_id,
+                          .node = std::string(req->getQuery("node").value_or("")),
+                          .capacity = ParseCapacity(req->getQuery()),
+                          .wire_version = ParseWireVersion(req->getQuery("wire-version")),
+                          .socket_id = 0},
                          req->getHeader("sec-websocket-key"),
                          req->getHeader("sec-websocket-protocol"),
                          req->getHeader("sec-websocket-extensions"), context);
@@ -79,14 +359,14 @@ void SchedulerApp::Run() {
              .open =
                  [&](auto *ws) {
                      Log("Runner ", ws->getUserData()->runner_id, " connected, partition = '",
-                         ws->getUserData()->partition, "'");
+                         ws->getUserData()->partition, "', cpus = ",
+                         ws->getUserData()->capacity.cpus);
                      scheduler_.JoinRunner(ws);
                  },
              .message =
                  [&](auto *ws, std::string_view message, uWS::OpCode op_code) {
-                     Log("Runner ", ws->getUserData()->runner_id, " finished");
-                     WorkflowState *workflow_ptr = ws->getUserData()->workflow_ptr;
-                     workflow_ptr->OnStatus(ws, message);
+                     LogDebug("Runner ", ws->getUserData()->runner_id, " finished");
+                     scheduler_.OnStatus(ws, message);
                  },
              .close =
                  [&](auto *ws, int code, std::string_view message) {
@@ -101,46 +381,34 @@ void SchedulerApp::Run() {
              .upgrade =
                  [&](auto *res, auto *req, auto *context) {
                      std::string workflow_id(req->getParameter("id"));
-                     WorkflowState *workflow_ptr = scheduler_.FindWorkflow(workflow_id);
-                     if (!workflow_ptr) {
+                     auto owner_id = scheduler_.FindWorkflowShard(workflow_id);
+                     if (!owner_id.has_value()) {
                          res->writeStatus(HTTP_NOT_FOUND)->end();
                          return;
                      }
                      res->template upgrade<ClientPerSocketData>(
-                         {.workflow_ptr = workflow_ptr}, req->getHeader("sec-websocket-key"),
+                         {.workflow_id = workflow_id,
+                          .owner_id = owner_id.value(),
+                          .after = ParseEventSeq(req->getQuery("after")),
+                          .socket_id = 0},
+                         req->getHeader("sec-websocket-key"),
                          req->getHeader("sec-websocket-protocol"),
                          req->getHeader("sec-websocket-extensions"), context);
                  },
              .open =
                  [&](auto *ws) {
-                     Log("Workflow ", ws->getUserData()->workflow_ptr->workflow_id,
-                         ": client connected");
+                     Log("Workflow ", ws->getUserData()->workflow_id, ": client connected");
                      scheduler_.JoinClient(ws);
                  },
              .message =
                  [&](auto *ws, std::string_view message, uWS::OpCode op_code) {
-                     WorkflowState *workflow_ptr = ws->getUserData()->workflow_ptr;
-                     Log("Workflow ", workflow_ptr->workflow_id, ": received signal '", message,
-                         "'");
-                     try {
-                         if (message == RUN_SIGNAL) {
-                             workflow_ptr->Run();
-                         } else if (message == STOP_SIGNAL) {
-                             workflow_ptr->Stop();
-                         } else {
-                             throw RuntimeError(UNDEFINED_COMMAND_ERROR);
-                         }
-                     } catch (const RuntimeError &error) {
-                         ws->send(ERROR_SIGNAL + std::string(" ") + error.message,
-                                  uWS::OpCode::TEXT);
-                         Log("Workflow ", workflow_ptr->workflow_id, ": runtime error '",
-                             error.message, "'");
-                     }
+                     Log("Workflow ", ws->getUserData()->workflow_id, ": received signal '",
+                         message, "'");
+                     scheduler_.OnSignal(ws, message);
                  },
              .close =
                  [&](auto *ws, int code, std::string_view message) {
-                     Log("Workflow ", ws->getUserData()->workflow_ptr->workflow_id,
-                         ": client disconnected");
+                     Log("Workflow ", ws->getUserData()->workflow_id, ": client disconnected");
                      scheduler_.LeaveClient(ws);
                  }})
         .listen(listen_host_, Config::Get().port,
@@ -148,7 +416,7 @@ void SchedulerApp::Run() {
                     if (listen_socket) {
                         Log("Listening on ", listen_host_, ":", Config::Get().port);
                     } else {
-                        Log("Failed to listen on ", listen_host_, ":", Config::Get().port);
+                        LogError("Failed to listen on ", listen_host_, ":", Config::Get().port);
                         exit(EXIT_FAILURE);
                     }
                 })
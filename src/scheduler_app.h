@@ -1,9 +1,14 @@
 #pragma once
 
+#include <cstddef>
+#include <latch>
 #include <string>
+#include <vector>
+#include <rapidjson/document.h>
 
 #include "json.h"
 #include "scheduler.h"
+#include "submit_response.h"
 
 class SchedulerApp {
 public:
@@ -15,9 +20,13 @@ public:
     void Run();
 
 private:
-    SchemaValidator workflow_validator_;
     Scheduler scheduler_;
     inline static const std::string listen_host_ = "0.0.0.0";
 
     SchedulerApp();
+
+    void RunLoop(size_t shard_id, std::latch &attached);
+    std::string SubmitBatch(const std::string &batch_text, SchemaValidator &workflow_validator);
+    std::vector<SubmitResponse> SubmitInstances(const WorkflowTemplate &workflow_template,
+                                                const rapidjson::Value &params_json);
 };
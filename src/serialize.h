@@ -3,8 +3,13 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+using JSONWriter = rapidjson::Writer<rapidjson::StringBuffer>;
 
 template <class T>
 rapidjson::Value Serialize(const T &data, rapidjson::Document::AllocatorType &alloc);
@@ -12,6 +17,10 @@ rapidjson::Value Serialize(const T &data, rapidjson::Document::AllocatorType &al
 template <class T>
 void Deserialize(T &data, const rapidjson::Value &value);
 
+// Emits the same JSON as Serialize straight through a writer, without building a tree first.
+template <class T>
+void Write(const T &data, JSONWriter &writer);
+
 template <class T>
 rapidjson::Document Serialize(const T &data) {
     rapidjson::Document document;
@@ -19,6 +28,25 @@ rapidjson::Document Serialize(const T &data) {
     return document;
 }
 
+inline rapidjson::StringBuffer &GetThreadJSONBuffer() {
+    static thread_local rapidjson::StringBuffer buffer;
+    return buffer;
+}
+
+// The view points into a buffer reused by every call on the same thread, so it is only valid
+// until the next one.
+template <class T>
+std::string_view ToJSON(const T &data, std::string_view prefix = {}) {
+    rapidjson::StringBuffer &buffer = GetThreadJSONBuffer();
+    buffer.Clear();
+    for (char c : prefix) {
+        buffer.Put(c);
+    }
+    JSONWriter writer(buffer);
+    Write(data, writer);
+    return std::string_view(buffer.GetString(), buffer.GetSize());
+}
+
 // bool
 template <>
 inline rapidjson::Value Serialize<bool>(const bool &data, rapidjson::Document::AllocatorType &) {
@@ -32,6 +60,11 @@ inline void Deserialize<bool>(bool &data, const rapidjson::Value &value) {
     data = value.GetBool();
 }
 
+template <>
+inline void Write<bool>(const bool &data, JSONWriter &writer) {
+    writer.Bool(data);
+}
+
 // int
 template <>
 inline rapidjson::Value Serialize<int>(const int &data, rapidjson::Document::AllocatorType &) {
@@ -45,6 +78,11 @@ inline void Deserialize<int>(int &data, const rapidjson::Value &value) {
     data = value.GetInt();
 }
 
+template <>
+inline void Write<int>(const int &data, JSONWriter &writer) {
+    writer.Int(data);
+}
+
 // int64_t
 template <>
 inline rapidjson::Value Serialize<int64_t>(const int64_t &data,
@@ -59,6 +97,11 @@ inline void Deserialize<int64_t>(int64_t &data, const rapidjson::Value &value) {
     data = value.GetInt64();
 }
 
+template <>
+inline void Write<int64_t>(const int64_t &data, JSONWriter &writer) {
+    writer.Int64(data);
+}
+
 // size_t
 template <>
 inline rapidjson::Value Serialize<size_t>(const size_t &data,
@@ -73,6 +116,11 @@ inline void Deserialize<size_t>(size_t &data, const rapidjson::Value &value) {
     data = value.GetUint64();
 }
 
+template <>
+inline void Write<size_t>(const size_t &data, JSONWriter &writer) {
+    writer.Uint64(data);
+}
+
 // std::string
 template <>
 inline rapidjson::Value Serialize<std::string>(const std::string &data,
@@ -87,6 +135,11 @@ inline void Deserialize<std::string>(std::string &data, const rapidjson::Value &
     data = value.GetString();
 }
 
+template <>
+inline void Write<std::string>(const std::string &data, JSONWriter &writer) {
+    writer.String(data.data(), static_cast<rapidjson::SizeType>(data.size()));
+}
+
 // std::optional
 template <class T>
 rapidjson::Value Serialize(const std::optional<T> &data,
@@ -108,6 +161,15 @@ void Deserialize(std::optional<T> &data, const rapidjson::Value &value) {
     }
 }
 
+template <class T>
+void Write(const std::optional<T> &data, JSONWriter &writer) {
+    if (data.has_value()) {
+        Write(data.value(), writer);
+    } else {
+        writer.Null();
+    }
+}
+
 // std::vector
 template <class T>
 rapidjson::Value Serialize(const std::vector<T> &data, rapidjson::Document::AllocatorType &alloc) {
@@ -125,3 +187,12 @@ void Deserialize(std::vector<T> &data, const rapidjson::Value &value) {
         Deserialize(data[i], value.GetArray()[i]);
     }
 }
+
+template <class T>
+void Write(const std::vector<T> &data, JSONWriter &writer) {
+    writer.StartArray();
+    for (const T &elem : data) {
+        Write(elem, writer);
+    }
+    writer.EndArray();
+}
@@ -18,6 +18,9 @@ void Start(const StartOptions &options) {
     RunnerStartOptions runner_options;
     runner_options.num = options.num_runners;
     runner_options.partition = options.partition;
+    runner_options.cpus = 1;
+    runner_options.memory_kb = 0;
+    runner_options.threads = 0;
     RunnerStart(runner_options);
     Daemonize();
     pid_file << getpid() << std::endl;
@@ -23,3 +23,13 @@ inline void Deserialize<SubmitResponse>(SubmitResponse &data, const rapidjson::V
     Deserialize(data.status, value["status"]);
     Deserialize(data.data, value["data"]);
 }
+
+template <>
+inline void Write<SubmitResponse>(const SubmitResponse &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("status");
+    Write(data.status, writer);
+    writer.Key("data");
+    Write(data.data, writer);
+    writer.EndObject();
+}
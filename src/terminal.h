@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 enum Color { RED, GREEN, YELLOW };
 
@@ -52,6 +54,8 @@ inline std::string AlignLeft(const std::string &text, size_t width) {
     return text + std::string(right_padding, ' ');
 }
 
+// Output is collected in a buffer and written to the terminal once per frame by Flush, so that a
+// redraw costs one write no matter how many lines it touches.
 class TerminalWindow {
 public:
     static TerminalWindow &Get() {
@@ -60,17 +64,47 @@ public:
     }
 
     void Clear() {
-        for (int i = 0; i < cnt_lines_; ++i) {
-            std::cerr << "\x1b[1A";
+        if (cnt_lines_ > 0) {
+            buffer_ += "\x1b[" + std::to_string(cnt_lines_) + "A\x1b[J";
         }
         cnt_lines_ = 0;
     }
 
     void PrintLine(const std::string &line) {
-        std::cerr << line << std::endl;
+        buffer_ += line;
+        buffer_ += "\x1b[K\n";
         ++cnt_lines_;
     }
 
+    // Rewrites one of the lines printed since the last Clear and returns the cursor below them.
+    void UpdateLine(int line_id, const std::string &line) {
+        std::string offset = std::to_string(cnt_lines_ - line_id);
+        buffer_ += "\x1b[" + offset + "A\r";
+        buffer_ += line;
+        buffer_ += "\x1b[K\r\x1b[" + offset + "B";
+    }
+
+    void Flush() {
+        if (!buffer_.empty()) {
+            std::cerr << buffer_ << std::flush;
+            buffer_.clear();
+        }
+    }
+
+    int CountLines() const {
+        return cnt_lines_;
+    }
+
+    static int GetHeight() {
+        winsize size;
+        if (ioctl(STDERR_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0) {
+            return kDefaultHeight;
+        }
+        return size.ws_row;
+    }
+
 private:
     int cnt_lines_ = 0;
+    std::string buffer_;
+    static constexpr int kDefaultHeight = 24;
 };
@@ -6,9 +6,9 @@
 #include <string>
 
 inline std::string GenerateUuid() {
-    static std::random_device rnd;
-    static std::mt19937 gen(rnd());
-    static std::uniform_int_distribution<> dis(0, 15);
+    static thread_local std::random_device rnd;
+    static thread_local std::mt19937 gen(rnd());
+    static thread_local std::uniform_int_distribution<> dis(0, 15);
     std::stringstream ss;
     ss << std::hex;
     for (int i = 0; i < 8; i++) {
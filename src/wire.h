@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "definitions.h"
+#include "error.h"
+
+// Binary encoding of the messages between the scheduler and runners, negotiated per runner as an
+// alternative to JSON. A message starts with a zero byte, which never starts a JSON text or a
+// signal, followed by the version of the encoding. Integers are little-endian of fixed width,
+// strings and vectors are prefixed with their length, and optionals with a presence byte.
+
+inline constexpr int kWireVersion = 1;
+
+class WireReader {
+public:
+    explicit WireReader(std::string_view data) : data_(data) {
+    }
+
+    std::string_view Read(size_t size) {
+        if (size > data_.size()) {
+            throw ParseError(WIRE_FORMAT_ERROR);
+        }
+        std::string_view bytes = data_.substr(0, size);
+        data_.remove_prefix(size);
+        return bytes;
+    }
+
+private:
+    std::string_view data_;
+};
+
+template <class T>
+void Encode(const T &data, std::string &out);
+
+template <class T>
+void Decode(T &data, WireReader &reader);
+
+template <class T>
+void EncodeInteger(T data, std::string &out) {
+    auto bits = static_cast<std::make_unsigned_t<T>>(data);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<char>((bits >> (8 * i)) & 0xff));
+    }
+}
+
+template <class T>
+void DecodeInteger(T &data, WireReader &reader) {
+    std::string_view bytes = reader.Read(sizeof(T));
+    std::make_unsigned_t<T> bits = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        bits |= static_cast<std::make_unsigned_t<T>>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+    }
+    data = static_cast<T>(bits);
+}
+
+inline void AppendWireString(std::string &out, std::string_view text) {
+    EncodeInteger(static_cast<uint32_t>(text.size()), out);
+    out.append(text);
+}
+
+inline bool IsWireMessage(std::string_view message) {
+    return !message.empty() && message[0] == '\0';
+}
+
+inline void EncodeHeader(std::string &out, int version = kWireVersion) {
+    out.push_back('\0');
+    out.push_back(static_cast<char>(version));
+}
+
+template <class T>
+std::string EncodeMessage(const T &data, int version = kWireVersion) {
+    std::string out;
+    EncodeHeader(out, version);
+    Encode(data, out);
+    return out;
+}
+
+// Returns the version the message was encoded with, so that the answer can use the same one.
+template <class T>
+int DecodeMessage(T &data, std::string_view message) {
+    WireReader reader(message);
+    std::string_view header = reader.Read(2);
+    int version = static_cast<uint8_t>(header[1]);
+    if (header[0] != '\0' || version == 0 || version > kWireVersion) {
+        throw ParseError(WIRE_VERSION_ERROR);
+    }
+    Decode(data, reader);
+    return version;
+}
+
+// bool
+template <>
+inline void Encode<bool>(const bool &data, std::string &out) {
+    out.push_back(data ? 1 : 0);
+}
+
+template <>
+inline void Decode<bool>(bool &data, WireReader &reader) {
+    data = reader.Read(1)[0] != 0;
+}
+
+// int
+template <>
+inline void Encode<int>(const int &data, std::string &out) {
+    EncodeInteger(static_cast<int32_t>(data), out);
+}
+
+template <>
+inline void Decode<int>(int &data, WireReader &reader) {
+    int32_t value;
+    DecodeInteger(value, reader);
+    data = value;
+}
+
+// int64_t
+template <>
+inline void Encode<int64_t>(const int64_t &data, std::string &out) {
+    EncodeInteger(data, out);
+}
+
+template <>
+inline void Decode<int64_t>(int64_t &data, WireReader &reader) {
+    DecodeInteger(data, reader);
+}
+
+// size_t
+template <>
+inline void Encode<size_t>(const size_t &data, std::string &out) {
+    EncodeInteger(static_cast<uint64_t>(data), out);
+}
+
+template <>
+inline void Decode<size_t>(size_t &data, WireReader &reader) {
+    uint64_t value;
+    DecodeInteger(value, reader);
+    data = value;
+}
+
+// std::string
+template <>
+inline void Encode<std::string>(const std::string &data, std::string &out) {
+    AppendWireString(out, data);
+}
+
+template <>
+inline void Decode<std::string>(std::string &data, WireReader &reader) {
+    uint32_t size;
+    DecodeInteger(size, reader);
+    data = reader.Read(size);
+}
+
+// std::optional
+template <class T>
+void Encode(const std::optional<T> &data, std::string &out) {
+    Encode(data.has_value(), out);
+    if (data.has_value()) {
+        Encode(data.value(), out);
+    }
+}
+
+template <class T>
+void Decode(std::optional<T> &data, WireReader &reader) {
+    bool has_value;
+    Decode(has_value, reader);
+    if (has_value) {
+        data.template emplace<>();
+        Decode(data.value(), reader);
+    } else {
+        data.reset();
+    }
+}
+
+// std::vector
+template <class T>
+void Encode(const std::vector<T> &data, std::string &out) {
+    EncodeInteger(static_cast<uint32_t>(data.size()), out);
+    for (const T &elem : data) {
+        Encode(elem, out);
+    }
+}
+
+template <class T>
+void Decode(std::vector<T> &data, WireReader &reader) {
+    uint32_t size;
+    DecodeInteger(size, reader);
+    data.clear();
+    for (uint32_t i = 0; i < size; ++i) {
+        Decode(data.emplace_back(), reader);
+    }
+}
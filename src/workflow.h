@@ -29,3 +29,15 @@ inline void Deserialize<Workflow>(Workflow &data, const rapidjson::Value &value)
     Deserialize(data.connections, value["connections"]);
     Deserialize(data.meta, value["meta"]);
 }
+
+template <>
+inline void Write<Workflow>(const Workflow &data, JSONWriter &writer) {
+    writer.StartObject();
+    writer.Key("blocks");
+    Write(data.blocks, writer);
+    writer.Key("connections");
+    Write(data.connections, writer);
+    writer.Key("meta");
+    Write(data.meta, writer);
+    writer.EndObject();
+}
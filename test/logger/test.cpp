@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "logger.h"
+
+// Sends whatever is written to stderr to a temporary file while alive.
+class StderrCapture {
+public:
+    StderrCapture() : file_(std::tmpfile()), saved_fd_(dup(STDERR_FILENO)) {
+        dup2(fileno(file_), STDERR_FILENO);
+    }
+
+    std::vector<std::string> ReadLines() {
+        std::vector<std::string> lines;
+        rewind(file_);
+        char buffer[4096];
+        std::string line;
+        while (fgets(buffer, sizeof(buffer), file_)) {
+            line += buffer;
+            if (line.ends_with('\n')) {
+                line.pop_back();
+                lines.push_back(std::move(line));
+                line.clear();
+            }
+        }
+        return lines;
+    }
+
+    ~StderrCapture() {
+        dup2(saved_fd_, STDERR_FILENO);
+        close(saved_fd_);
+        fclose(file_);
+    }
+
+private:
+    FILE *file_;
+    int saved_fd_;
+};
+
+bool Contains(const std::vector<std::string> &lines, const std::string &text) {
+    for (const auto &line : lines) {
+        if (line.ends_with(text)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(Logger, Levels) {
+    StderrCapture capture;
+    bool evaluated = false;
+    Logger::Get().SetLevel(static_cast<int>(LogLevel::kWarning));
+    LogDebug("debug message");
+    Log("info message ", [&] {
+        evaluated = true;
+        return 1;
+    });
+    LogWarning("warning message ", -1, ' ', 2u, ' ', true);
+    LogError("error message");
+    Logger::Get().SetLevel(static_cast<int>(LogLevel::kDebug));
+    LogDebug("enabled debug message");
+    Logger::Get().SetLevel(static_cast<int>(LogLevel::kInfo));
+    auto lines = capture.ReadLines();
+    EXPECT_FALSE(Contains(lines, "] debug: debug message"));
+    EXPECT_FALSE(Contains(lines, "info message 1"));
+    EXPECT_FALSE(evaluated);
+    EXPECT_TRUE(Contains(lines, "warning: warning message -1 2 1"));
+    EXPECT_TRUE(Contains(lines, "error: error message"));
+    // Debug messages are compiled out below MIN_LOG_LEVEL whatever the level set at runtime.
+    EXPECT_EQ(Contains(lines, "debug: enabled debug message"), MIN_LOG_LEVEL <= 0);
+}
+
+TEST(Logger, Producers) {
+    const int kProducers = 8;
+    const int kMessages = 10000;
+    StderrCapture capture;
+    Logger::Get().Start();
+    std::vector<std::thread> producers;
+    for (int producer_id = 0; producer_id < kProducers; ++producer_id) {
+        producers.emplace_back([producer_id] {
+            for (int message_id = 0; message_id < kMessages; ++message_id) {
+                Log("producer ", producer_id, " message ", message_id);
+            }
+        });
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    // Everything queued is written out on the way down.
+    Logger::Get().Stop();
+    // Messages of a producer come in the order they were logged, and the ones that did not fit
+    // into the queue are counted.
+    std::map<int, int> last_message_ids;
+    int cnt_written = 0, cnt_dropped = 0;
+    for (const auto &line : capture.ReadLines()) {
+        size_t position = line.find("] ");
+        ASSERT_NE(position, std::string::npos);
+        std::istringstream text(line.substr(position + 2));
+        std::string word;
+        text >> word;
+        if (word == "producer") {
+            int producer_id, message_id;
+            text >> producer_id >> word >> message_id;
+            auto iter = last_message_ids.find(producer_id);
+            if (iter != last_message_ids.end()) {
+                EXPECT_LT(iter->second, message_id);
+            }
+            last_message_ids[producer_id] = message_id;
+            ++cnt_written;
+        } else if (word == "warning:") {
+            int cnt;
+            text >> word >> cnt;
+            EXPECT_EQ(word, "dropped");
+            cnt_dropped += cnt;
+        }
+    }
+    EXPECT_EQ(cnt_written + cnt_dropped, kProducers * kMessages);
+    // Once stopped, messages are written right away again.
+    StderrCapture stopped_capture;
+    Log("after stop");
+    EXPECT_TRUE(Contains(stopped_capture.ReadLines(), "after stop"));
+}
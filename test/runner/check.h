@@ -5,14 +5,17 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "gtest/gtest.h"
 #include "config.h"
+#include "definitions.h"
 #include "json.h"
 #include "net.h"
 #include "run_request.h"
 #include "run_response.h"
 #include "uuid.h"
+#include "wire.h"
 
 namespace fs = std::filesystem;
 
@@ -42,13 +45,28 @@ std::string ReadFile(const std::string &abspath) {
     return ss.str();
 }
 
-RunResponse SendRunRequest(const RunRequest &request) {
+RunResponse SendRunRequest(const RunRequest &request, int cancel_delay_ms = -1,
+                           bool binary = false) {
     static WebsocketServer server("0.0.0.0", Config::Get().port);
     static SchemaValidator response_validator(SCHEMA_DIR "/run_response.json");
     auto session = server.Accept();
-    session.Write(StringifyJSON(Serialize(request)));
+    if (binary) {
+        session.Write(EncodeMessage(request), true);
+    } else {
+        session.Write(StringifyJSON(Serialize(request)));
+    }
+    if (cancel_delay_ms != -1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(cancel_delay_ms));
+        session.Write(CANCEL_SIGNAL + std::string(" ") + std::to_string(request.task_id));
+    }
     RunResponse response;
-    Deserialize(response, response_validator.ParseAndValidate(session.Read()));
+    std::string message = session.Read();
+    if (binary) {
+        EXPECT_TRUE(IsWireMessage(message));
+        DecodeMessage(response, message);
+    } else {
+        Deserialize(response, response_validator.ParseAndValidate(message));
+    }
     return response;
 }
 
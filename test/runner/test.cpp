@@ -118,3 +118,63 @@ TEST(Execution, MemoryLimit) {
     ASSERT_TRUE(response.status.has_value());
     ASSERT_TRUE(response.status->memory_limit_exceeded);
 }
+
+TEST(Execution, OutputDigests) {
+    std::string container_path1 = CreateContainer();
+    std::string container_path2 = CreateContainer();
+    auto response1 = SendRunRequest({.binds = {{".", container_path1, false}},
+                                     .argv = {"bash", "-c", "echo test >output"},
+                                     .outputs = {"output", "missing"}});
+    CheckExitedNormally(response1);
+    ASSERT_EQ(response1.output_digests.size(), 2);
+    ASSERT_FALSE(response1.output_digests[0].empty());
+    ASSERT_TRUE(response1.output_digests[1].empty());
+    auto response2 = SendRunRequest({.binds = {{".", container_path2, false}},
+                                     .argv = {"bash", "-c", "echo test >output"},
+                                     .outputs = {"output", "missing"}});
+    CheckExitedNormally(response2);
+    ASSERT_EQ(response2.output_digests, response1.output_digests);
+}
+
+TEST(Execution, OutputManifest) {
+    std::string container_path = CreateContainer();
+    auto response = SendRunRequest({.binds = {{".", container_path, false}},
+                                    .argv = {"bash", "-c", "echo test >output; mkdir dir"},
+                                    .outputs = {"output", "missing", "dir"}});
+    CheckExitedNormally(response);
+    ASSERT_EQ(response.manifest.size(), 2);
+    ASSERT_EQ(response.manifest[0].path, "output");
+    ASSERT_EQ(response.manifest[0].size, 5);
+    ASSERT_EQ(response.manifest[1].path, "dir");
+}
+
+TEST(Execution, Cancel) {
+    std::string container_path = CreateContainer();
+    auto start_time = Timestamp();
+    auto response = SendRunRequest(
+        {.binds = {{".", container_path, false}}, .argv = {"bash", "-c", "sleep 1; touch marker"}},
+        500);
+    auto end_time = Timestamp();
+    ASSERT_EQ(response.error, CANCELLED_ERROR);
+    CheckDuration(end_time - start_time, 500);
+    // The sandboxed command is stopped, not just left behind.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    ASSERT_FALSE(fs::exists(fs::path(container_path) / "marker"));
+}
+
+TEST(Protocol, Binary) {
+    std::string container_path = CreateContainer();
+    auto response = SendRunRequest({.task_id = 42,
+                                    .binds = {{".", container_path, false}},
+                                    .argv = {"bash", "-c", "echo test >output"},
+                                    .constraints = {.wall_time_limit_ms = 1000},
+                                    .outputs = {"output", "missing"}},
+                                   -1, true);
+    CheckExitedNormally(response);
+    ASSERT_EQ(response.task_id, 42);
+    ASSERT_EQ(response.output_digests.size(), 2);
+    ASSERT_FALSE(response.output_digests[0].empty());
+    ASSERT_TRUE(response.output_digests[1].empty());
+    ASSERT_EQ(response.manifest.size(), 1);
+    ASSERT_EQ(response.manifest[0].size, 5);
+}
@@ -4,6 +4,8 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <csignal>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <mutex>
@@ -14,6 +16,7 @@
 
 #include "gtest/gtest.h"
 #include "block_response.h"
+#include "client_snapshot.h"
 #include "config.h"
 #include "definitions.h"
 #include "json.h"
@@ -25,9 +28,9 @@
 
 namespace fs = std::filesystem;
 
-SubmitResponse Submit(const std::string &body) {
+SubmitResponse Submit(const std::string &body, const std::string &target = "/submit") {
     std::string submit_response_text =
-        HttpSession(Config::Get().host, Config::Get().port).Post("/submit", body);
+        HttpSession(Config::Get().host, Config::Get().port).Post(target, body);
     if (submit_response_text.empty()) {
         throw std::runtime_error("submit response empty");
     }
@@ -36,10 +39,32 @@ SubmitResponse Submit(const std::string &body) {
     return submit_response;
 }
 
+std::vector<SubmitResponse> SubmitBatch(const std::string &body,
+                                        const std::string &target = "/submit-batch") {
+    std::string submit_response_text =
+        HttpSession(Config::Get().host, Config::Get().port).Post(target, body);
+    if (submit_response_text.empty()) {
+        throw std::runtime_error("submit response empty");
+    }
+    std::vector<SubmitResponse> submit_responses;
+    Deserialize(submit_responses, ParseJSON(submit_response_text));
+    return submit_responses;
+}
+
 SubmitResponse SubmitWorkflow(const Workflow &workflow) {
     return Submit(StringifyJSON(Serialize(workflow)));
 }
 
+std::string ReadMessage(WebsocketClientSession &session) {
+    std::string result;
+    session.OnRead([&](const std::string &message) {
+        result = message;
+        session.Stop();
+    });
+    session.Run();
+    return result;
+}
+
 long long Timestamp() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(
                std::chrono::system_clock::now().time_since_epoch())
@@ -63,15 +88,23 @@ void ImitateRun(const Workflow &workflow, int runner_delay,
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(runner_delay));
     for (const auto &output : workflow.blocks[block_id].outputs) {
+        if (output.streaming) {
+            ASSERT_TRUE(fs::is_fifo(container_path / output.path));
+            continue;
+        }
         ASSERT_TRUE(!fs::exists(container_path / output.path));
         std::ofstream((container_path / output.path).string());
     }
     bool failed =
         std::find(failed_blocks.begin(), failed_blocks.end(), block_id) != failed_blocks.end();
+    response.task_id = request.task_id;
     if (failed) {
         response.error = "Some error";
     } else {
-        response.status = {.exited = true, .exit_code = 0};
+        response.status = {.exited = true, .exit_code = 0, .wall_time_usage_ms = runner_delay};
+        for (const auto &output : workflow.blocks[block_id].outputs) {
+            response.manifest.push_back({.path = output.path, .size = 0, .mtime_ns = 0});
+        }
     }
 }
 
@@ -92,6 +125,9 @@ void CheckExecution(const Workflow &workflow, int cnt_clients, int cnt_runners,
             session.Connect(Config::Get().host, Config::Get().port,
                             "/runner/" + workflow.meta.partition + "/" + std::to_string(runner_id));
             session.OnRead([&](const std::string &message) {
+                if (message.starts_with(CANCEL_SIGNAL)) {
+                    return;
+                }
                 request_validator_mutex.lock();
                 auto document = request_validator.ParseAndValidate(message);
                 request_validator_mutex.unlock();
@@ -114,7 +150,10 @@ void CheckExecution(const Workflow &workflow, int cnt_clients, int cnt_runners,
         client_threads[client_id] = std::thread([&] {
             session.Connect(Config::Get().host, Config::Get().port, "/workflow/" + workflow_id);
             int cnt_blocks_completed = 0;
-            session.OnRead([&](const std::string &message) {
+            session.OnRead([&](std::string message) {
+                if (message.starts_with(EVENT_SIGNAL)) {
+                    message.erase(0, message.find(' ', strlen(EVENT_SIGNAL) + 1) + 1);
+                }
                 if (message.starts_with(WORKFLOW_SIGNAL)) {
                     if (message.substr(strlen(WORKFLOW_SIGNAL) + 1) == FINISHED_STATE) {
                         if (++cnt_clients_completed == cnt_clients) {
@@ -129,6 +168,15 @@ void CheckExecution(const Workflow &workflow, int cnt_clients, int cnt_runners,
                     if (response.state == FINISHED_STATE) {
                         ++cnt_blocks_completed;
                     }
+                } else if (message.starts_with(BLOCK_BATCH_SIGNAL)) {
+                    std::string responses_text = message.substr(strlen(BLOCK_BATCH_SIGNAL) + 1);
+                    std::vector<BlockResponse> responses;
+                    Deserialize(responses, ParseJSON(responses_text));
+                    for (const auto &response : responses) {
+                        if (response.state == FINISHED_STATE) {
+                            ++cnt_blocks_completed;
+                        }
+                    }
                 }
             });
             if (++cnt_clients_connected == cnt_clients) {
@@ -158,3 +206,138 @@ void CheckExecution(const Workflow &workflow, int cnt_clients, int cnt_runners,
         runner_threads[runner_id].join();
     }
 }
+
+// Watches the workflow from a client of its own, starting it first if asked to, and returns the
+// block responses the client got once the workflow has finished.
+std::vector<BlockResponse> WaitForCompletion(const std::string &workflow_id, bool run = false) {
+    std::vector<BlockResponse> responses;
+    WebsocketClientSession session;
+    session.Connect(Config::Get().host, Config::Get().port, "/workflow/" + workflow_id);
+    session.OnRead([&](std::string message) {
+        if (message.starts_with(EVENT_SIGNAL)) {
+            message.erase(0, message.find(' ', strlen(EVENT_SIGNAL) + 1) + 1);
+        }
+        if (message == WORKFLOW_SIGNAL " " FINISHED_STATE) {
+            session.Stop();
+        } else if (message.starts_with(BLOCK_SIGNAL)) {
+            Deserialize(responses.emplace_back(),
+                        ParseJSON(message.substr(strlen(BLOCK_SIGNAL) + 1)));
+        } else if (message.starts_with(BLOCK_BATCH_SIGNAL)) {
+            std::vector<BlockResponse> batch;
+            Deserialize(batch, ParseJSON(message.substr(strlen(BLOCK_BATCH_SIGNAL) + 1)));
+            responses.insert(responses.end(), batch.begin(), batch.end());
+        }
+    });
+    if (run) {
+        session.Write(RUN_SIGNAL);
+    }
+    session.Run();
+    return responses;
+}
+
+std::vector<BlockResponse> RunToCompletion(const std::string &workflow_id) {
+    return WaitForCompletion(workflow_id, true);
+}
+
+// Kills the scheduler the way a crash would and starts it again from its journal.
+void RestartScheduler() {
+    fs::path pid_path = fs::path(RUN_DIR) / "scheduler.pid";
+    pid_t pid = 0;
+    std::ifstream(pid_path.string()) >> pid;
+    ASSERT_GT(pid, 0);
+    ASSERT_EQ(kill(pid, SIGKILL), 0);
+    while (kill(pid, 0) == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    fs::remove(pid_path);
+    ASSERT_EQ(std::system("polygraph start"), 0);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+}
+
+// A runner driven by the test, which records the containers of the requests it gets in the
+// order they come and answers them like ImitateRun, except for the stalled blocks, which are
+// never answered. Outputs are reported with the digest set last, if any. Cancel signals are only
+// counted.
+class TestRunner {
+public:
+    TestRunner(const Workflow &workflow, const std::string &target, int runner_delay,
+               const std::vector<size_t> &stalled_blocks = {})
+        : workflow_(workflow), runner_delay_(runner_delay), stalled_blocks_(stalled_blocks) {
+        session_.Connect(Config::Get().host, Config::Get().port, target);
+        session_.OnRead([this](const std::string &message) { OnMessage(message); });
+        thread_ = std::thread([this] { session_.Run(); });
+        // The runner joins its partition on the event loop, after the handshake is over.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    std::vector<std::string> GetContainerIds() {
+        std::lock_guard lock(mutex_);
+        return container_ids_;
+    }
+
+    std::vector<size_t> GetBlockIds() {
+        std::vector<size_t> block_ids;
+        for (const auto &container_id : GetContainerIds()) {
+            block_ids.push_back(ParseBlockId(container_id));
+        }
+        return block_ids;
+    }
+
+    void SetOutputDigest(const std::string &output_digest) {
+        std::lock_guard lock(mutex_);
+        output_digest_ = output_digest;
+    }
+
+    int CountCancels() const {
+        return cnt_cancels_;
+    }
+
+    void WaitForRequests(size_t cnt_requests) {
+        while (GetContainerIds().size() < cnt_requests) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    ~TestRunner() {
+        session_.Stop();
+        thread_.join();
+    }
+
+private:
+    const Workflow &workflow_;
+    int runner_delay_;
+    std::vector<size_t> stalled_blocks_;
+    WebsocketClientSession session_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<std::string> container_ids_;
+    std::string output_digest_;
+    std::atomic<int> cnt_cancels_ = 0;
+
+    void OnMessage(const std::string &message) {
+        if (message.starts_with(CANCEL_SIGNAL)) {
+            ++cnt_cancels_;
+            return;
+        }
+        RunRequest request;
+        Deserialize(request, ParseJSON(message));
+        std::string container_id = fs::path(request.binds[0].outside).filename().string();
+        {
+            std::lock_guard lock(mutex_);
+            container_ids_.push_back(container_id);
+        }
+        size_t block_id = ParseBlockId(container_id);
+        if (std::find(stalled_blocks_.begin(), stalled_blocks_.end(), block_id) !=
+            stalled_blocks_.end()) {
+            return;
+        }
+        RunResponse response;
+        ImitateRun(workflow_, runner_delay_, {}, request, response);
+        {
+            std::lock_guard lock(mutex_);
+            response.output_digests.assign(workflow_.blocks[block_id].outputs.size(),
+                                           output_digest_);
+        }
+        session_.Write(StringifyJSON(Serialize(response)));
+    }
+};
@@ -4,6 +4,7 @@
 
 #include "gtest/gtest.h"
 #include "check.h"
+#include "uuid.h"
 
 const int kRunnerDelay = 500;
 const Meta kWorkflowMeta = {"sample workflow", "all", INT_MAX};
@@ -72,6 +73,28 @@ TEST(ValidationError, DuplicatedLocation) {
         DUPLICATED_PATH_ERROR);
 }
 
+TEST(ValidationError, InvalidStream) {
+    EXPECT_EQ(SubmitWorkflow({{{.outputs = {{"a", true}}}}, {}, kWorkflowMeta}).data,
+              INVALID_STREAM_ERROR);
+    EXPECT_EQ(SubmitWorkflow({{{.inputs = {{"b", false}}, .outputs = {{"a", true}}}},
+                              {{0, 0, 0, 0}},
+                              kWorkflowMeta})
+                  .data,
+              INVALID_STREAM_ERROR);
+    EXPECT_EQ(SubmitWorkflow({{{.outputs = {{"a", true}}},
+                               {.inputs = {{"a", false}}},
+                               {.inputs = {{"a", false}}}},
+                              {{0, 0, 1, 0}, {0, 0, 2, 0}},
+                              kWorkflowMeta})
+                  .data,
+              INVALID_STREAM_ERROR);
+    EXPECT_EQ(SubmitWorkflow({{{.outputs = {{"a", true}}}, {.inputs = {{"a", true}}}},
+                              {{0, 0, 1, 0}},
+                              kWorkflowMeta})
+                  .data,
+              INVALID_STREAM_ERROR);
+}
+
 TEST(Submit, WorkflowIdUnique) {
     std::unordered_set<std::string> ids;
     for (int i = 0; i < 1000; i++) {
@@ -82,6 +105,44 @@ TEST(Submit, WorkflowIdUnique) {
     ASSERT_EQ(ids.size(), 1000);
 }
 
+TEST(Submit, Batch) {
+    std::string workflow = StringifyJSON(Serialize(Workflow{{{}}, {}, kWorkflowMeta}));
+    std::string invalid_workflow =
+        StringifyJSON(Serialize(Workflow{{{.outputs = {{"a"}}}}, {{0, 0, 1, 0}}, kWorkflowMeta}));
+    auto submit_responses = SubmitBatch("[" + workflow + ",{}," + workflow + "]");
+    ASSERT_EQ(submit_responses.size(), 3);
+    EXPECT_EQ(submit_responses[0].status, SUBMIT_ACCEPTED);
+    EXPECT_EQ(submit_responses[1].status, SUBMIT_VALIDATION_ERROR);
+    EXPECT_EQ(submit_responses[2].status, SUBMIT_ACCEPTED);
+    EXPECT_NE(submit_responses[0].data, submit_responses[2].data);
+    submit_responses = SubmitBatch(workflow + "\n{\n\n" + invalid_workflow + "\n");
+    ASSERT_EQ(submit_responses.size(), 3);
+    EXPECT_EQ(submit_responses[0].status, SUBMIT_ACCEPTED);
+    EXPECT_EQ(submit_responses[1].status, SUBMIT_PARSE_ERROR);
+    EXPECT_EQ(submit_responses[2].status, SUBMIT_VALIDATION_ERROR);
+    EXPECT_EQ(submit_responses[2].data, INVALID_CONNECTION_ERROR);
+}
+
+TEST(Submit, Template) {
+    Workflow workflow = {
+        {{.binds = {{"a", "/tmp/${dir}"}}, .argv = {"echo", "${x}", "$${x}"}}}, {}, kWorkflowMeta};
+    auto template_response = Submit(StringifyJSON(Serialize(workflow)), "/template");
+    ASSERT_EQ(template_response.status, SUBMIT_ACCEPTED);
+    std::string target = "/template/" + template_response.data + "/submit";
+    EXPECT_EQ(Submit("{\"x\":\"1\",\"dir\":\"d\"}", target).status, SUBMIT_ACCEPTED);
+    EXPECT_EQ(Submit("{\"x\":\"1\"}", target).data, UNDEFINED_PARAMETER_ERROR);
+    EXPECT_EQ(Submit("{\"x\":1,\"dir\":\"d\"}", target).data, INVALID_PARAMETERS_ERROR);
+    auto submit_responses =
+        SubmitBatch("[{\"x\":\"1\",\"dir\":\"d\"},{\"x\":\"2\",\"dir\":\"e\"}]", target);
+    ASSERT_EQ(submit_responses.size(), 2);
+    EXPECT_EQ(submit_responses[0].status, SUBMIT_ACCEPTED);
+    EXPECT_EQ(submit_responses[1].status, SUBMIT_ACCEPTED);
+    EXPECT_THROW(Submit("{}", "/template/unknown/submit"), std::runtime_error);
+    Workflow misplaced = {{{.binds = {{"${dir}", "/tmp"}}}}, {}, kWorkflowMeta};
+    EXPECT_EQ(Submit(StringifyJSON(Serialize(misplaced)), "/template").data,
+              MISPLACED_PARAMETER_ERROR);
+}
+
 TEST(Submit, MaxPayloadLength) {
     std::string body;
     body.resize(Config::Get().scheduler_max_payload_length, '.');
@@ -115,6 +176,15 @@ TEST(Execution, Bamboo) {
     CheckExecution(workflow, 5, 10, 3, kRunnerDelay, 3 * kRunnerDelay);
 }
 
+TEST(Execution, StreamingBamboo) {
+    Workflow workflow = {{{.outputs = {{"a", true}}},
+                          {.inputs = {{"a", false}}, .outputs = {{"b", true}}},
+                          {.inputs = {{"b", false}}}},
+                         {{0, 0, 1, 0}, {1, 0, 2, 0}},
+                         kWorkflowMeta};
+    CheckExecution(workflow, 5, 3, 3, kRunnerDelay, kRunnerDelay);
+}
+
 TEST(Execution, Parallel) {
     Workflow workflow = {{{}, {}, {}}, {}, kWorkflowMeta};
     CheckExecution(workflow, 5, 1, 3, kRunnerDelay, 3 * kRunnerDelay);
@@ -216,6 +286,81 @@ TEST(Execution, CachedInputs) {
     CheckExecution(workflow, 3, 2, 11, kRunnerDelay, 7 * kRunnerDelay);
 }
 
+TEST(Execution, CachedResults) {
+    std::vector<std::string> argv = {GenerateUuid()};
+    Workflow workflow = {{{.outputs = {{"a"}}, .argv = argv, .cache_results = true},
+                          {.inputs = {{"a", false}}, .outputs = {{"b"}}, .argv = argv,
+                           .cache_results = true},
+                          {.inputs = {{"b", false}}, .argv = argv, .cache_results = true}},
+                         {{0, 0, 1, 0}, {1, 0, 2, 0}},
+                         kWorkflowMeta};
+    CheckExecution(workflow, 3, 2, 3, kRunnerDelay, 3 * kRunnerDelay);
+    CheckExecution(workflow, 3, 2, 3, kRunnerDelay, 0);
+    // Cached results are taken before a runner is looked for, so none is needed.
+    workflow.meta = {"cached", "cached", INT_MAX};
+    auto responses = RunToCompletion(SubmitWorkflow(workflow).data);
+    ASSERT_EQ(responses.size(), 3);
+    for (const auto &response : responses) {
+        EXPECT_EQ(response.state, FINISHED_STATE);
+    }
+}
+
+TEST(Execution, CachedResultsBindChanged) {
+    fs::path dir_path = fs::path("/tmp/polygraph") / GenerateUuid();
+    fs::create_directories(dir_path / "sub");
+    std::ofstream((dir_path / "sub" / "file").string()) << "a";
+    Workflow workflow = {
+        {{.binds = {{"dir", dir_path.string(), true}}, .argv = {GenerateUuid()},
+          .cache_results = true}},
+        {},
+        {"bind", "bind", INT_MAX}};
+    TestRunner runner(workflow, "/runner/bind/0", kRunnerDelay);
+    RunToCompletion(SubmitWorkflow(workflow).data);
+    RunToCompletion(SubmitWorkflow(workflow).data);
+    EXPECT_EQ(runner.GetBlockIds().size(), 1);
+    // Editing a file deep inside the bound directory leaves the directories themselves as they
+    // were, and still invalidates the cached result.
+    std::ofstream((dir_path / "sub" / "file").string()) << "ab";
+    RunToCompletion(SubmitWorkflow(workflow).data);
+    EXPECT_EQ(runner.GetBlockIds().size(), 2);
+    fs::remove_all(dir_path);
+}
+
+TEST(Execution, EarlyCutoff) {
+    fs::path dir_path = fs::path("/tmp/polygraph") / GenerateUuid();
+    fs::create_directories(dir_path);
+    std::ofstream((dir_path / "file").string()) << "a";
+    Workflow workflow = {{{.outputs = {{"a"}}},
+                          {.inputs = {{"a", false}},
+                           .outputs = {{"b"}},
+                           .binds = {{"dir", dir_path.string(), true}}},
+                          {.inputs = {{"b", false}}}},
+                         {{0, 0, 1, 0}, {1, 0, 2, 0}},
+                         {"cutoff", "cutoff", INT_MAX}};
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    TestRunner runner(workflow, "/runner/cutoff/0", kRunnerDelay);
+    runner.SetOutputDigest("digest");
+    auto run = [&] {
+        size_t cnt_requests = runner.GetBlockIds().size();
+        auto responses = RunToCompletion(workflow_id);
+        auto block_ids = runner.GetBlockIds();
+        for (const auto &response : responses) {
+            EXPECT_EQ(response.state, FINISHED_STATE);
+        }
+        return std::vector<size_t>(block_ids.begin() + cnt_requests, block_ids.end());
+    };
+    EXPECT_EQ(run(), (std::vector<size_t>{0, 1, 2}));
+    // Blocks that get the same inputs and binds again finish as up to date without a runner.
+    EXPECT_EQ(run(), std::vector<size_t>{0});
+    // A different output runs everything downstream of it again.
+    runner.SetOutputDigest("other digest");
+    EXPECT_EQ(run(), (std::vector<size_t>{0, 1, 2}));
+    // So does a change to a bind, up to where the outputs come out the same as before.
+    std::ofstream((dir_path / "file").string()) << "ab";
+    EXPECT_EQ(run(), (std::vector<size_t>{0, 1}));
+    fs::remove_all(dir_path);
+}
+
 TEST(Execution, FailedBlocks) {
     Workflow workflow = {{{.outputs = {{"a"}}},
                           {.inputs = {{"a", false}}},
@@ -234,3 +379,314 @@ TEST(Execution, Stress) {
         CheckExecution(workflow, 4, 4, 100, 0, -1);
     }
 }
+
+TEST(Execution, ResumedClient) {
+    auto submit_response = SubmitWorkflow(Workflow{{}, {}, kWorkflowMeta});
+    ASSERT_EQ(submit_response.status, SUBMIT_ACCEPTED);
+    std::string target = "/workflow/" + submit_response.data;
+    std::string finished_event =
+        EVENT_SIGNAL " 1 " WORKFLOW_SIGNAL " " + std::string(FINISHED_STATE);
+    {
+        WebsocketClientSession session;
+        session.Connect(Config::Get().host, Config::Get().port, target);
+        session.Write(RUN_SIGNAL);
+        EXPECT_EQ(ReadMessage(session), finished_event);
+    }
+    {
+        WebsocketClientSession session;
+        session.Connect(Config::Get().host, Config::Get().port, target + "?after=0");
+        EXPECT_EQ(ReadMessage(session), finished_event);
+    }
+    {
+        WebsocketClientSession session;
+        session.Connect(Config::Get().host, Config::Get().port, target + "?after=2");
+        std::string message = ReadMessage(session);
+        ASSERT_TRUE(message.starts_with(SNAPSHOT_SIGNAL));
+        ClientSnapshot snapshot;
+        Deserialize(snapshot, ParseJSON(message.substr(strlen(SNAPSHOT_SIGNAL) + 1)));
+        EXPECT_EQ(snapshot.seq, 1);
+        EXPECT_FALSE(snapshot.running);
+    }
+    // Snapshots tell how many times each block has been started in the run.
+    Workflow workflow = {{{}}, {}, {"resume", "resume", INT_MAX}};
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    {
+        TestRunner runner(workflow, "/runner/resume/0", kRunnerDelay);
+        RunToCompletion(workflow_id);
+    }
+    WebsocketClientSession session;
+    session.Connect(Config::Get().host, Config::Get().port,
+                    "/workflow/" + workflow_id + "?after=1000000");
+    std::string message = ReadMessage(session);
+    ASSERT_TRUE(message.starts_with(SNAPSHOT_SIGNAL));
+    ClientSnapshot snapshot;
+    Deserialize(snapshot, ParseJSON(message.substr(strlen(SNAPSHOT_SIGNAL) + 1)));
+    ASSERT_EQ(snapshot.blocks.size(), 1);
+    EXPECT_EQ(snapshot.cnt_runs, std::vector<size_t>{1});
+}
+
+TEST(Execution, RunnerLost) {
+    Workflow workflow = {{{}}, {}, {"retry", "retry", INT_MAX}};
+    int max_retries = Config::Get().scheduler_max_retries;
+    int backoff_ms = Config::Get().scheduler_retry_backoff_ms;
+    auto count_retries = [](const std::vector<BlockResponse> &responses) {
+        return std::count_if(responses.begin(), responses.end(), [](const auto &response) {
+            return response.state == RETRYING_STATE;
+        });
+    };
+    // A block that loses its runner is run again elsewhere once the backoff is over.
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    std::vector<BlockResponse> responses;
+    std::thread client_thread([&] { responses = RunToCompletion(workflow_id); });
+    long long lost_time;
+    {
+        TestRunner lost_runner(workflow, "/runner/retry/0", kRunnerDelay, {0});
+        lost_runner.WaitForRequests(1);
+        lost_time = Timestamp();
+    }
+    {
+        TestRunner runner(workflow, "/runner/retry/1", kRunnerDelay);
+        client_thread.join();
+        EXPECT_GE(Timestamp() - lost_time, backoff_ms + kRunnerDelay);
+        EXPECT_EQ(runner.GetBlockIds(), std::vector<size_t>{0});
+    }
+    ASSERT_FALSE(responses.empty());
+    EXPECT_EQ(count_retries(responses), 1);
+    EXPECT_EQ(responses.back().state, FINISHED_STATE);
+    EXPECT_FALSE(responses.back().error.has_value());
+    // Past the retry cap it finishes with an error instead.
+    workflow_id = SubmitWorkflow(workflow).data;
+    client_thread = std::thread([&] { responses = RunToCompletion(workflow_id); });
+    for (int retry = 0; retry <= max_retries; ++retry) {
+        TestRunner lost_runner(workflow, "/runner/retry/" + std::to_string(retry), kRunnerDelay,
+                               {0});
+        lost_runner.WaitForRequests(1);
+    }
+    client_thread.join();
+    ASSERT_FALSE(responses.empty());
+    EXPECT_EQ(count_retries(responses), max_retries);
+    EXPECT_EQ(responses.back().state, FINISHED_STATE);
+    EXPECT_EQ(responses.back().error, RUNNER_LOST_ERROR);
+}
+
+TEST(Execution, CriticalPathFirst) {
+    Workflow workflow = {{{},
+                          {},
+                          {.outputs = {{"a"}}},
+                          {.inputs = {{"a", false}}, .outputs = {{"b"}}},
+                          {.inputs = {{"b", false}}}},
+                         {{2, 0, 3, 0}, {3, 0, 4, 0}},
+                         {"priority", "priority", 1}};
+    // With blocks handed out one at a time, the chain holding up the workflow the longest goes
+    // first.
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    std::thread client_thread(RunToCompletion, workflow_id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kRunnerDelay));
+    TestRunner runner(workflow, "/runner/priority/0", kRunnerDelay);
+    client_thread.join();
+    EXPECT_EQ(runner.GetBlockIds(), (std::vector<size_t>{2, 3, 0, 1, 4}));
+}
+
+TEST(Dispatch, FairShare) {
+    Workflow workflow = {{{}, {}, {}}, {}, {"fair", "fair", INT_MAX}};
+    // Workflows sharing a runner take turns instead of the first one running to completion.
+    std::string first_workflow_id = SubmitWorkflow(workflow).data;
+    std::string second_workflow_id = SubmitWorkflow(workflow).data;
+    std::thread first_client_thread(RunToCompletion, first_workflow_id);
+    std::thread second_client_thread(RunToCompletion, second_workflow_id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kRunnerDelay));
+    TestRunner runner(workflow, "/runner/fair/0", kRunnerDelay);
+    first_client_thread.join();
+    second_client_thread.join();
+    auto container_ids = runner.GetContainerIds();
+    ASSERT_EQ(container_ids.size(), 6);
+    for (size_t i = 1; i < container_ids.size(); ++i) {
+        EXPECT_NE(container_ids[i].substr(0, container_ids[i].find('_')),
+                  container_ids[i - 1].substr(0, container_ids[i - 1].find('_')));
+    }
+}
+
+TEST(Dispatch, BestFit) {
+    Workflow workflow = {{{}}, {}, {"fit", "fit", INT_MAX}};
+    // The block goes to the runner it leaves the fewest cpus spare on, keeping the large one free.
+    TestRunner large_runner(workflow, "/runner/fit/0?cpus=4", kRunnerDelay);
+    TestRunner small_runner(workflow, "/runner/fit/1?cpus=1", kRunnerDelay);
+    RunToCompletion(SubmitWorkflow(workflow).data);
+    EXPECT_EQ(small_runner.GetBlockIds(), std::vector<size_t>{0});
+    EXPECT_TRUE(large_runner.GetBlockIds().empty());
+}
+
+TEST(Dispatch, Locality) {
+    Workflow workflow = {{{.outputs = {{"a"}}}, {.inputs = {{"a", false}}}, {}},
+                         {{0, 0, 1, 0}},
+                         {"locality", "locality", INT_MAX}};
+    int locality_wait_ms = Config::Get().scheduler_locality_wait_ms;
+    // The first block runs on node a, which then gets busy with the third one while the second,
+    // reading the output of the first, becomes ready. An idle runner on node b turns up then, and
+    // the second block waits for node a, which frees up before the deadline.
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    std::thread client_thread(RunToCompletion, workflow_id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kRunnerDelay));
+    {
+        TestRunner local_runner(workflow, "/runner/locality/0?node=a", kRunnerDelay);
+        local_runner.WaitForRequests(2);
+        TestRunner remote_runner(workflow, "/runner/locality/1?node=b", kRunnerDelay);
+        client_thread.join();
+        EXPECT_EQ(local_runner.GetBlockIds(), (std::vector<size_t>{0, 2, 1}));
+        EXPECT_TRUE(remote_runner.GetBlockIds().empty());
+    }
+    // When node a stays busy past the deadline, the block falls back to node b.
+    workflow_id = SubmitWorkflow(workflow).data;
+    client_thread = std::thread(RunToCompletion, workflow_id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kRunnerDelay));
+    TestRunner local_runner(workflow, "/runner/locality/0?node=a", locality_wait_ms + kRunnerDelay);
+    local_runner.WaitForRequests(2);
+    auto ready_time = Timestamp();
+    TestRunner remote_runner(workflow, "/runner/locality/1?node=b", kRunnerDelay);
+    remote_runner.WaitForRequests(1);
+    EXPECT_GE(Timestamp() - ready_time, locality_wait_ms - 100);
+    client_thread.join();
+    EXPECT_EQ(local_runner.GetBlockIds(), (std::vector<size_t>{0, 2}));
+    EXPECT_EQ(remote_runner.GetBlockIds(), std::vector<size_t>{1});
+}
+
+TEST(Protocol, MalformedRunnerMessage) {
+    {
+        WebsocketClientSession session;
+        session.Connect(Config::Get().host, Config::Get().port, "/runner/all/0?wire-version=1");
+        session.Write("{\"task-id\": ");
+        session.Write("[1, 2, 3]");
+        session.Write(std::string("\0\1\7", 3));
+        session.Write(std::string("\0\x7f", 2));
+    }
+    Workflow workflow = {{{}}, {}, kWorkflowMeta};
+    CheckExecution(workflow, 1, 1, 1, kRunnerDelay, kRunnerDelay);
+}
+
+TEST(Speculation, StalledRunner) {
+    if (Config::Get().scheduler_speculation_factor <= 0) {
+        GTEST_SKIP() << "speculation is turned off";
+    }
+    Workflow workflow = {{{}, {}}, {}, {"speculation", "speculation", INT_MAX}};
+    auto submit_response = SubmitWorkflow(workflow);
+    ASSERT_EQ(submit_response.status, SUBMIT_ACCEPTED);
+    TestRunner stalled_runner(workflow, "/runner/speculation/0", kRunnerDelay, {0, 1});
+    std::thread client_thread(RunToCompletion, submit_response.data);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kRunnerDelay));
+    // The second block runs here first, which gives the stalled one an expected wall time.
+    TestRunner runner(workflow, "/runner/speculation/1", kRunnerDelay);
+    client_thread.join();
+    auto container_ids = runner.GetContainerIds();
+    ASSERT_EQ(container_ids.size(), 2);
+    EXPECT_TRUE(container_ids[1].ends_with("_speculative"));
+    EXPECT_EQ(stalled_runner.CountCancels(), 1);
+}
+
+TEST(Fanout, BatchedEvents) {
+    if (Config::Get().scheduler_client_batch_ms <= 0) {
+        GTEST_SKIP() << "client batching is turned off";
+    }
+    Workflow workflow = {{{}, {}, {}}, {}, {"fanout", "fanout", INT_MAX}};
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    // Clients watching the same workflow get the same events, and the blocks that start together
+    // are reported in a single message.
+    const int kClients = 2;
+    std::vector<std::string> messages[kClients];
+    WebsocketClientSession sessions[kClients];
+    for (int client_id = 0; client_id < kClients; ++client_id) {
+        sessions[client_id].Connect(Config::Get().host, Config::Get().port,
+                                    "/workflow/" + workflow_id);
+        sessions[client_id].OnRead([&, client_id](std::string message) {
+            if (message.ends_with(WORKFLOW_SIGNAL " " FINISHED_STATE)) {
+                sessions[client_id].Stop();
+            }
+            messages[client_id].push_back(std::move(message));
+        });
+    }
+    TestRunner runner(workflow, "/runner/fanout/0?cpus=3", kRunnerDelay);
+    std::vector<std::thread> client_threads;
+    for (int client_id = 0; client_id < kClients; ++client_id) {
+        client_threads.emplace_back([&, client_id] {
+            if (client_id == 0) {
+                sessions[client_id].Write(RUN_SIGNAL);
+            }
+            sessions[client_id].Run();
+        });
+    }
+    for (auto &client_thread : client_threads) {
+        client_thread.join();
+    }
+    EXPECT_EQ(messages[0], messages[1]);
+    size_t max_batch_size = 0;
+    for (std::string message : messages[0]) {
+        message.erase(0, message.find(' ', strlen(EVENT_SIGNAL) + 1) + 1);
+        if (message.starts_with(BLOCK_BATCH_SIGNAL)) {
+            std::vector<BlockResponse> batch;
+            Deserialize(batch, ParseJSON(message.substr(strlen(BLOCK_BATCH_SIGNAL) + 1)));
+            max_batch_size = std::max(max_batch_size, batch.size());
+        }
+    }
+    EXPECT_EQ(max_batch_size, 3);
+}
+
+TEST(Archive, IdleWorkflows) {
+    if (Config::Get().scheduler_max_workflows > 1) {
+        GTEST_SKIP() << "idle workflows are kept";
+    }
+    // Workflows of a partition share a shard, so running a second one there archives the first.
+    const int kEvictionDelay = 2500;
+    Workflow workflow = {{{}, {}}, {}, {"archive", "archive", INT_MAX}};
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    TestRunner runner(workflow, "/runner/archive/0", kRunnerDelay);
+    RunToCompletion(workflow_id);
+    RunToCompletion(SubmitWorkflow(workflow).data);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kEvictionDelay));
+    // An archived workflow still reports the final states of its blocks, and a resuming client
+    // gets them as a snapshot that tells no more events will come.
+    WebsocketClientSession session;
+    session.Connect(Config::Get().host, Config::Get().port, "/workflow/" + workflow_id);
+    for (size_t block_id = 0; block_id < workflow.blocks.size(); ++block_id) {
+        std::string message = ReadMessage(session);
+        ASSERT_TRUE(message.starts_with(BLOCK_SIGNAL));
+        BlockResponse response;
+        Deserialize(response, ParseJSON(message.substr(strlen(BLOCK_SIGNAL) + 1)));
+        EXPECT_EQ(response.state, FINISHED_STATE);
+    }
+    WebsocketClientSession resumed_session;
+    resumed_session.Connect(Config::Get().host, Config::Get().port,
+                            "/workflow/" + workflow_id + "?after=1");
+    std::string message = ReadMessage(resumed_session);
+    ASSERT_TRUE(message.starts_with(SNAPSHOT_SIGNAL));
+    ClientSnapshot snapshot;
+    Deserialize(snapshot, ParseJSON(message.substr(strlen(SNAPSHOT_SIGNAL) + 1)));
+    EXPECT_EQ(snapshot.seq, 0);
+    EXPECT_FALSE(snapshot.running);
+    EXPECT_EQ(snapshot.blocks.size(), workflow.blocks.size());
+    EXPECT_TRUE(snapshot.cnt_runs.empty());
+}
+
+TEST(Recovery, SchedulerKilled) {
+    Workflow workflow = {{{.outputs = {{"a"}}}, {.inputs = {{"a", false}}}},
+                         {{0, 0, 1, 0}},
+                         {"recovery", "recovery", INT_MAX}};
+    std::string workflow_id = SubmitWorkflow(workflow).data;
+    {
+        TestRunner runner(workflow, "/runner/recovery/0", kRunnerDelay, {1});
+        WebsocketClientSession session;
+        session.Connect(Config::Get().host, Config::Get().port, "/workflow/" + workflow_id);
+        session.Write(RUN_SIGNAL);
+        runner.WaitForRequests(2);
+        RestartScheduler();
+    }
+    // The finished block is taken from the journal, the one that was running is started over.
+    std::vector<BlockResponse> responses;
+    std::thread client_thread([&] { responses = WaitForCompletion(workflow_id); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(kRunnerDelay));
+    TestRunner runner(workflow, "/runner/recovery/0", kRunnerDelay);
+    client_thread.join();
+    EXPECT_EQ(runner.GetBlockIds(), std::vector<size_t>{1});
+    ASSERT_FALSE(responses.empty());
+    EXPECT_EQ(responses.back().block_id, 1);
+    EXPECT_EQ(responses.back().state, FINISHED_STATE);
+    EXPECT_FALSE(responses.back().error.has_value());
+}
@@ -1,5 +1,13 @@
 #!/usr/bin/env bash
 
+# Logger tests
+./build/test/logger/test_logger
+STATUS=$?
+if [ $STATUS != 0 ]; then
+    echo "Logger tests failed"
+    exit $STATUS
+fi
+
 # Scheduler tests
 ./test_scheduler.sh
 STATUS=$?
@@ -1,7 +1,23 @@
 #!/usr/bin/env bash
 
+CONF_PATH=/etc/polygraph/config.json
+
 polygraph start
 sleep 1 && ./build/test/scheduler/test_scheduler
 STATUS=$?
 polygraph stop
+if [ $STATUS != 0 ]; then
+    exit $STATUS
+fi
+
+# Features that are off by default are tested against a scheduler started with them on, and the
+# configuration is restored afterwards.
+cp $CONF_PATH $CONF_PATH.bak
+polygraph config set --scheduler-speculation-factor 3 --scheduler-client-batch-ms 50 \
+    --scheduler-max-workflows 1
+polygraph start
+sleep 1 && ./build/test/scheduler/test_scheduler --gtest_filter='Speculation.*:Fanout.*:Archive.*'
+STATUS=$?
+polygraph stop
+mv $CONF_PATH.bak $CONF_PATH
 exit $STATUS